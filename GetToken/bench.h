@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "histogram.h"
+#include "json.h"
+
+namespace Benchmark
+{
+    /// <summary>
+    /// Latency of one fixed scenario of --bench
+    /// </summary>
+    struct ScenarioResult
+    {
+        std::string Name;
+        LatencySummary Summary;
+        int Failed = 0;     // Samples whose request did not succeed (they are still measured)
+    };
+
+    /// <summary>
+    /// A scenario as recorded in a baseline file
+    /// </summary>
+    struct BaselineEntry
+    {
+        std::string Name;
+        Milliseconds P50{};
+        Milliseconds P90{};
+        std::optional<double> ThresholdPercent;     // Overrides the threshold of the run for this scenario
+    };
+
+    /// <summary>
+    /// A scenario of this run next to its baseline
+    /// </summary>
+    struct Comparison
+    {
+        const ScenarioResult* Current = nullptr;
+        const BaselineEntry* Baseline = nullptr;
+        double P50Change = 0;       // Relative, e.g. 0.25 for 25% slower
+        double P90Change = 0;
+        double ThresholdPercent = 0;
+        bool Gated = true;          // false for a single-sample scenario, whose change is reported but never a regression
+        bool Regressed = false;
+    };
+
+    // Samples per scenario without --iterations
+    inline constexpr auto DefaultSamples = 20;
+
+    // Calls per sample of the sync scenarios
+    inline constexpr auto BatchSize = 1000;
+
+    // Changes smaller than this are noise whatever the percentage (e.g. 2 us -> 3 us of a trace write)
+    inline constexpr auto NoiseFloor = Milliseconds{ 0.05 };
+
+    /// <summary>
+    /// Sample a sync function in batches and record the average time per call, so that the clock does not dominate
+    /// calls of a few hundred nanoseconds.
+    /// </summary>
+    template <typename F>
+    void MeasureBatches(ScenarioResult& result, int samples, F&& call)
+    {
+        auto histogram = Histogram{};
+
+        for (int sample = 0; sample < samples; ++sample)
+        {
+            const auto start = Clock::now();
+
+            for (int i = 0; i < BatchSize; ++i)
+            {
+                call(i);
+            }
+
+            histogram.Add((Clock::now() - start) / BatchSize);
+        }
+
+        result.Summary = histogram.GetSummary();
+    }
+
+    /// <summary>
+    /// Await sample() the given number of times, one call after another, and record the latency of each call.
+    /// </summary>
+    /// <param name="sample">Returns an IAsyncOperation&lt;bool&gt; telling whether the call succeeded</param>
+    template <typename F>
+    IAsyncAction MeasureAsync(ScenarioResult& result, int samples, F sample)
+    {
+        auto histogram = Histogram{};
+
+        for (int i = 0; i < samples; ++i)
+        {
+            const auto start = Clock::now();
+            const auto succeeded = co_await sample();
+            histogram.Add(Clock::now() - start);
+
+            if (not succeeded)
+            {
+                ++result.Failed;
+            }
+        }
+
+        result.Summary = histogram.GetSummary();
+    }
+
+    namespace detail
+    {
+        // Find "name": in one JSON object line and return the position after the colon and any spaces
+        inline std::optional<std::size_t> FindValue(std::string_view json, std::string_view name)
+        {
+            auto pos = std::size_t{ 0 };
+
+            while ((pos = json.find(name, pos)) != std::string_view::npos)
+            {
+                const auto begin = pos;
+                pos += name.size();
+
+                if (begin == 0 || json[begin - 1] != '"' || pos >= json.size() || json[pos] != '"')
+                {
+                    continue;
+                }
+
+                auto cursor = json.find_first_not_of(" \t", pos + 1);
+
+                if (cursor == std::string_view::npos || json[cursor] != ':')
+                {
+                    continue;
+                }
+
+                cursor = json.find_first_not_of(" \t", cursor + 1);
+
+                if (cursor == std::string_view::npos)
+                {
+                    return std::nullopt;
+                }
+
+                return cursor;
+            }
+
+            return std::nullopt;
+        }
+
+        inline std::optional<double> FindNumber(std::string_view json, std::string_view name)
+        {
+            const auto cursor = FindValue(json, name);
+
+            if (not cursor)
+            {
+                return std::nullopt;
+            }
+
+            auto value = double{};
+            const auto [end, ec] = std::from_chars(json.data() + *cursor, json.data() + json.size(), value);
+
+            if (ec != std::errc{})
+            {
+                return std::nullopt;
+            }
+
+            return value;
+        }
+
+        // Scenario names are written by FormatBaseline, so they have no escaped characters
+        inline std::optional<std::string_view> FindString(std::string_view json, std::string_view name)
+        {
+            const auto cursor = FindValue(json, name);
+
+            if (not cursor || json[*cursor] != '"')
+            {
+                return std::nullopt;
+            }
+
+            const auto end = json.find('"', *cursor + 1);
+
+            if (end == std::string_view::npos)
+            {
+                return std::nullopt;
+            }
+
+            return json.substr(*cursor + 1, end - *cursor - 1);
+        }
+    }
+
+    /// <summary>
+    /// Format the results as a baseline: JSON Lines, one object per scenario, e.g.
+    /// {"name":"GetTokenSilentlyAsync(Warm)","count":20,"p50Ms":12.345678,"p90Ms":...}
+    /// A "thresholdPct" member can be added by hand to give a scenario its own threshold.
+    /// </summary>
+    inline std::string FormatBaseline(const std::vector<ScenarioResult>& results)
+    {
+        auto out = std::string{};
+
+        for (const auto& result : results)
+        {
+            auto writer = Json::Writer{ out };
+            const auto& summary = result.Summary;
+
+            writer.BeginObject()
+                .Key("name").String(result.Name)
+                .Key("count").Number(static_cast<std::int64_t>(summary.Count))
+                .Key("failed").Number(std::int64_t{ result.Failed })
+                .Key("minMs").Number(summary.Min.count(), 6)
+                .Key("meanMs").Number(summary.Mean.count(), 6)
+                .Key("p50Ms").Number(summary.P50.count(), 6)
+                .Key("p90Ms").Number(summary.P90.count(), 6)
+                .Key("p99Ms").Number(summary.P99.count(), 6)
+                .Key("maxMs").Number(summary.Max.count(), 6)
+                .EndObject();
+            out.push_back('\n');
+        }
+
+        return out;
+    }
+
+    /// <summary>
+    /// Read a baseline written by FormatBaseline. Lines without a name & p50Ms are skipped.
+    /// </summary>
+    inline std::vector<BaselineEntry> ParseBaseline(std::string_view text)
+    {
+        auto entries = std::vector<BaselineEntry>{};
+
+        while (not text.empty())
+        {
+            const auto end = text.find('\n');
+            const auto line = text.substr(0, end);
+            text = end == std::string_view::npos ? std::string_view{} : text.substr(end + 1);
+
+            const auto name = detail::FindString(line, "name");
+            const auto p50 = detail::FindNumber(line, "p50Ms");
+
+            if (not name || not p50)
+            {
+                continue;
+            }
+
+            entries.push_back(BaselineEntry{
+                .Name = std::string{ *name },
+                .P50 = Milliseconds{ *p50 },
+                .P90 = Milliseconds{ detail::FindNumber(line, "p90Ms").value_or(*p50) },
+                .ThresholdPercent = detail::FindNumber(line, "thresholdPct")
+            });
+        }
+
+        return entries;
+    }
+
+    /// <returns>nullopt if the file does not exist or cannot be read</returns>
+    inline std::optional<std::vector<BaselineEntry>> LoadBaseline(const std::filesystem::path& path)
+    {
+        auto file = std::ifstream{ path, std::ios::binary };
+
+        if (not file)
+        {
+            return std::nullopt;
+        }
+
+        auto text = std::ostringstream{};
+        text << file.rdbuf();
+        return ParseBaseline(text.view());
+    }
+
+    /// <summary>
+    /// Write the baseline file. Throws std::runtime_error on failure.
+    /// </summary>
+    inline void SaveBaseline(const std::filesystem::path& path, const std::vector<ScenarioResult>& results)
+    {
+        const auto text = FormatBaseline(results);
+        auto file = std::ofstream{ path, std::ios::binary | std::ios::trunc };
+
+        if (not file.write(text.data(), static_cast<std::streamsize>(text.size())))
+        {
+            throw std::runtime_error{ std::format("Failed to write the baseline to {}", path.string()) };
+        }
+    }
+
+    /// <summary>
+    /// Compare each scenario with its baseline. A scenario regressed if its p50 or p90 grew by more than the threshold,
+    /// and by more than NoiseFloor. Scenarios that are not in the baseline are left out, and a single sample (e.g. the cold
+    /// token request) is too noisy to gate on, so it is only reported.
+    /// </summary>
+    inline std::vector<Comparison> Compare(const std::vector<ScenarioResult>& results, const std::vector<BaselineEntry>& baseline, double thresholdPercent)
+    {
+        auto comparisons = std::vector<Comparison>{};
+
+        const auto change = [](Milliseconds current, Milliseconds base) {
+            return base.count() > 0 ? current / base - 1.0 : 0.0;
+        };
+
+        for (const auto& result : results)
+        {
+            const auto it = std::ranges::find(baseline, result.Name, &BaselineEntry::Name);
+
+            if (it == baseline.end())
+            {
+                continue;
+            }
+
+            auto& comparison = comparisons.emplace_back();
+            comparison.Current = &result;
+            comparison.Baseline = &*it;
+            comparison.P50Change = change(result.Summary.P50, it->P50);
+            comparison.P90Change = change(result.Summary.P90, it->P90);
+            comparison.ThresholdPercent = it->ThresholdPercent.value_or(thresholdPercent);
+
+            comparison.Gated = result.Summary.Count > 1;
+
+            const auto limit = comparison.ThresholdPercent / 100.0;
+            comparison.Regressed = comparison.Gated && (
+                (comparison.P50Change > limit && result.Summary.P50 - it->P50 > NoiseFloor) ||
+                (comparison.P90Change > limit && result.Summary.P90 - it->P90 > NoiseFloor));
+        }
+
+        return comparisons;
+    }
+}
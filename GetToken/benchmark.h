@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "histogram.h"
+
+namespace Benchmark
+{
+    /// <summary>
+    /// Where a silent request was probably served from
+    /// </summary>
+    enum class PathClass
+    {
+        Cache,      // The broker returned a token it already had
+        Network,    // The broker fetched a new token
+    };
+
+    /// <summary>
+    /// Shared state of a load test run.
+    /// Workers call TryAcquire() to pick the next iteration until all iterations are handed out.
+    /// Successful samples are also classified as cache-served or network-served, each class with its own histogram.
+    /// </summary>
+    class LoadTest final
+    {
+    public:
+        /// <param name="cacheThreshold">Latency up to which a request is considered cache-served when the token has no iat claim</param>
+        LoadTest(int iterations, Clock::duration cacheThreshold) :
+            _iterations{ iterations },
+            _cacheThreshold{ cacheThreshold },
+            _startTime{ std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count() }
+        {}
+
+        bool TryAcquire(int& iteration) noexcept
+        {
+            iteration = _next.fetch_add(1, std::memory_order_relaxed);
+            return iteration < _iterations;
+        }
+
+        void Record(Clock::duration latency, bool succeeded)
+        {
+            _latency.Add(latency);
+            (succeeded ? _succeeded : _failed).fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Record a successful request and classify it.
+        /// A token is new (network) if its iat differs from the previous token's, or, for the first token, if it was
+        /// issued after the test started. Without an iat claim, the latency decides.
+        /// </summary>
+        /// <param name="issuedAt">iat claim of the returned token, if it is a JWT</param>
+        PathClass Record(Clock::duration latency, std::optional<std::int64_t> issuedAt)
+        {
+            Record(latency, true);
+
+            auto pathClass = latency <= _cacheThreshold ? PathClass::Cache : PathClass::Network;
+
+            if (issuedAt)
+            {
+                const auto previous = _lastIssuedAt.exchange(*issuedAt, std::memory_order_relaxed);
+
+                if (previous == NoIssuedAt)
+                {
+                    pathClass = *issuedAt < _startTime ? PathClass::Cache : PathClass::Network;
+                }
+                else
+                {
+                    pathClass = previous == *issuedAt ? PathClass::Cache : PathClass::Network;
+                }
+            }
+
+            (pathClass == PathClass::Cache ? _cacheLatency : _networkLatency).Add(latency);
+            return pathClass;
+        }
+
+        // A failure before the measured call was made (no latency to record)
+        void RecordFailure() noexcept
+        {
+            _failed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        int Iterations() const noexcept { return _iterations; }
+        int Succeeded() const noexcept { return _succeeded.load(); }
+        int Failed() const noexcept { return _failed.load(); }
+        LatencySummary GetSummary() const { return _latency.GetSummary(); }
+        LatencySummary GetSummary(PathClass pathClass) const { return (pathClass == PathClass::Cache ? _cacheLatency : _networkLatency).GetSummary(); }
+
+    private:
+        static constexpr auto NoIssuedAt = std::int64_t{ -1 };
+
+        const int _iterations;
+        const Clock::duration _cacheThreshold;
+        const std::int64_t _startTime; // Unix time in seconds, to compare with iat
+        std::atomic<int> _next{ 0 };
+        std::atomic<int> _succeeded{ 0 };
+        std::atomic<int> _failed{ 0 };
+        std::atomic<std::int64_t> _lastIssuedAt{ NoIssuedAt };
+        Histogram _latency;
+        Histogram _cacheLatency;
+        Histogram _networkLatency;
+    };
+}
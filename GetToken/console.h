@@ -1,7 +1,13 @@
 #pragma once
 
-#include <print>
+#include <array>
+#include <cstdio>
+#include <format>
+#include <initializer_list>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <utility>
 
 #ifndef WIN32_MEAN_AND_LEAN
 #define WIN32_MEAN_AND_LEAN
@@ -20,6 +26,29 @@ namespace Console
         // State of Virtual Terminal
         inline auto vtEnabled = false;
 
+        // Whether WriteOut() goes to stderr instead of stdout
+        inline auto useStandardError = false;
+
+        struct Output
+        {
+            HANDLE Handle = nullptr;
+            bool IsConsole = false;
+        };
+
+        inline Output GetOutput(DWORD stdHandle) noexcept
+        {
+            // No need to close this handle
+            const auto handle = ::GetStdHandle(stdHandle);
+
+            if (handle == nullptr || handle == INVALID_HANDLE_VALUE)
+            {
+                return {};
+            }
+
+            auto mode = DWORD{};
+            return Output{ handle, ::GetConsoleMode(handle, &mode) != FALSE };
+        }
+
         inline bool SetVirtualTerminal(bool enable)
         {
             // No need to close this handle
@@ -73,6 +102,20 @@ namespace Console
         return detail::SetVirtualTerminal(false);
     }
 
+    /// <summary>
+    /// Write to stderr instead of stdout from now on (e.g. while stdout carries JSON Lines). Call at startup.
+    /// Styles are dropped if stderr is redirected, so that no escape sequences end up in the file.
+    /// </summary>
+    inline void UseStandardError() noexcept
+    {
+        detail::useStandardError = true;
+
+        if (not detail::GetOutput(STD_ERROR_HANDLE).IsConsole)
+        {
+            detail::vtEnabled = false;
+        }
+    }
+
     /// <summary>
     /// See the following article for VT:
     /// Console Virtual Terminal Sequence
@@ -114,112 +157,316 @@ namespace Console
 #define OSC ESC "]" // Operating System Command
 
     /// <summary>
-    /// Reset certain properties (Rendition, Charset, Cursor Keys Mode, etc.) to their default values
+    /// A set of Format attributes as a ready-made SGR escape sequence (e.g. "\x1b[31;1m").
+    /// Built by a constexpr constructor, so constexpr styles (see ConsoleFormat) cost nothing at run time.
     /// </summary>
-    inline void SoftReset()
+    class Style final
     {
-        std::print(CSI "!p");
-    }
+    public:
+        constexpr Style(std::initializer_list<Format> formats) noexcept
+        {
+            Append(CSI);
 
-    /// <summary>
-    /// Reset all attributes to the default state prior to modification
-    /// </summary>
-    inline void ResetFormat()
+            for (auto first = true; const auto format : formats)
+            {
+                if (not first)
+                {
+                    Push(';');
+                }
+
+                AppendNumber(static_cast<int>(format));
+                first = false;
+            }
+
+            Push('m');
+        }
+
+        constexpr std::string_view Sequence() const noexcept
+        {
+            return { _sequence.data(), _size };
+        }
+
+    private:
+        constexpr void Push(const char c) noexcept
+        {
+            if (_size < _sequence.size())
+            {
+                _sequence[_size++] = c;
+            }
+        }
+
+        constexpr void Append(std::string_view text) noexcept
+        {
+            for (const auto c : text)
+            {
+                Push(c);
+            }
+        }
+
+        constexpr void AppendNumber(const int value) noexcept
+        {
+            // Format values are at most 2 digits
+            if (value >= 10)
+            {
+                Push(static_cast<char>('0' + value / 10));
+            }
+
+            Push(static_cast<char>('0' + value % 10));
+        }
+
+        // Room for 15 attributes
+        std::array<char, 48> _sequence{};
+        std::size_t _size = 0;
+    };
+
+    inline constexpr auto ResetSequence = std::string_view{ CSI "0m" };
+
+    namespace detail
     {
-        std::print(CSI "0m");
-    }
+        // Buffer of the Block active on this thread, if any
+        inline thread_local std::string* _block = nullptr;
+
+        inline std::string& BlockBuffer()
+        {
+            thread_local auto buffer = std::string{};
+            return buffer;
+        }
 
-    namespace detail {
         /// <summary>
-        /// Get an underlying value of an enum type variable
+        /// Write UTF-8 text with a single call: WriteConsoleW (the console takes UTF-16 regardless of its code page),
+        /// or WriteFile when stdout (or stderr, see UseStandardError) is redirected.
         /// </summary>
-        template <typename Enum>
-        auto to_value(Enum const value) -> typename std::underlying_type<Enum>::type
+        inline void WriteOut(std::string_view text) noexcept
         {
-            return static_cast<typename std::underlying_type<Enum>::type>(value);
+            if (text.empty())
+            {
+                return;
+            }
+
+            static const auto stdOut = GetOutput(STD_OUTPUT_HANDLE);
+            static const auto stdErr = GetOutput(STD_ERROR_HANDLE);
+            const auto [handle, isConsole] = useStandardError ? stdErr : stdOut;
+
+            if (handle == nullptr)
+            {
+                return;
+            }
+
+            // Output written through stdio (e.g. JSON Lines) goes out first, so that the order is kept
+            std::fflush(stdout);
+
+            auto written = DWORD{};
+
+            if (isConsole)
+            {
+                thread_local auto wbuffer = std::wstring{};
+                wbuffer.clear();
+                Util::to_wstring(text, wbuffer, CP_UTF8);
+                ::WriteConsoleW(handle, wbuffer.data(), static_cast<DWORD>(wbuffer.size()), &written, nullptr);
+            }
+            else
+            {
+                ::WriteFile(handle, text.data(), static_cast<DWORD>(text.size()), &written, nullptr);
+            }
         }
 
-        inline void Write(const std::initializer_list<Format>& consoleFormat, std::string_view text)
+        /// <summary>
+        /// Let append(std::string&) add text to the active Block, or to a per-thread buffer that is written out at once.
+        /// Either way one line, with its escape sequences & line break, is a single write.
+        /// </summary>
+        template <typename F>
+        void Append(F&& append)
         {
-            if (vtEnabled)
+            if (_block)
             {
-                auto formatString = std::string{ CSI };
+                append(*_block);
+                return;
+            }
 
-                for (const auto& fmt : consoleFormat)
-                {
-                    formatString.append(std::to_string(detail::to_value(fmt))).append(";");
-                }
+            thread_local auto buffer = std::string{};
+            buffer.clear();
+            append(buffer);
+            WriteOut(buffer);
+        }
+
+        template <typename... Args>
+        void FormatTo(std::string& out, const std::format_string<Args...> format, Args&&... args)
+        {
+            std::format_to(std::back_inserter(out), format, std::forward<Args>(args)...);
+        }
 
-                // Replace the last ";" with "m"
-                formatString.back() = 'm';
+        template <typename... Args>
+        void FormatTo(std::string& out, const std::wformat_string<Args...> format, Args&&... args)
+        {
+            // std::print does not work on wchar_t (on MSVC), but std::format does.
+            thread_local auto wbuffer = std::wstring{};
+            wbuffer.clear();
+            std::format_to(std::back_inserter(wbuffer), format, std::forward<Args>(args)...);
+            Util::to_string(wbuffer, out);
+        }
 
-                std::print("{}{}", formatString, text);
-                ResetFormat();
+        // Wrap appendText's output in the style's sequence & a reset (unless VT is off)
+        template <typename F>
+        void AppendStyled(std::string& out, const Style& style, F&& appendText)
+        {
+            if (vtEnabled)
+            {
+                out.append(style.Sequence());
+                appendText(out);
+                out.append(ResetSequence);
             }
             else
             {
-                std::print("{}",text);
+                appendText(out);
             }
         }
     }
 
+    /// <summary>
+    /// Collect the console output of this thread until the block ends, then write it with a single call.
+    /// Nested blocks join the outermost one. Flush() writes what has been collected so far.
+    /// Note: The block is per thread, so do not keep one across co_await.
+    /// </summary>
+    class Block final
+    {
+    public:
+        [[nodiscard]] Block() noexcept : _outermost{ detail::_block == nullptr }
+        {
+            if (_outermost)
+            {
+                detail::BlockBuffer().clear();
+                detail::_block = &detail::BlockBuffer();
+            }
+        }
+
+        Block(const Block&) = delete;
+        Block& operator=(const Block&) = delete;
+
+        ~Block()
+        {
+            if (_outermost)
+            {
+                Flush();
+                detail::_block = nullptr;
+            }
+        }
+
+        void Flush() noexcept
+        {
+            if (_outermost)
+            {
+                detail::WriteOut(detail::BlockBuffer());
+                detail::BlockBuffer().clear();
+            }
+        }
+
+    private:
+        bool _outermost;
+    };
+
+    /// <summary>
+    /// Reset certain properties (Rendition, Charset, Cursor Keys Mode, etc.) to their default values
+    /// </summary>
+    inline void SoftReset()
+    {
+        detail::Append([](std::string& out) { out.append(CSI "!p"); });
+    }
+
+    /// <summary>
+    /// Reset all attributes to the default state prior to modification
+    /// </summary>
+    inline void ResetFormat()
+    {
+        detail::Append([](std::string& out) { out.append(ResetSequence); });
+    }
+
     /*
-      Following Write/WriteLine functions are bacially thin wrappers around std::print/println with optional Console::Format parameter.
+      Following Write/WriteLine functions format straight into the output buffer (see detail::Append), with an optional Style.
       Overloaded for both char & wchar_t variants.
     */
 
     template <typename... Args>
     void Write(const std::format_string<Args...> format, Args&&... args)
     {
-        // Just forward to std::print
-        std::print(format, std::forward<Args>(args)...);
+        detail::Append([&](std::string& out) { detail::FormatTo(out, format, std::forward<Args>(args)...); });
     }
 
     template <typename... Args>
     void Write(const std::wformat_string<Args...> format, Args&&... args)
     {
-        // std::print does not work on wchar_t (on MSVC), but std::format does.
-        std::print("{}", Util::to_string(std::format(format, std::forward<Args>(args)...)));
+        detail::Append([&](std::string& out) { detail::FormatTo(out, format, std::forward<Args>(args)...); });
     }
 
     template <typename... Args>
-    void Write(const std::initializer_list<Format>& consoleFormat, const std::format_string<Args...> format, Args&&... args)
+    void Write(const Style& style, const std::format_string<Args...> format, Args&&... args)
     {
-        detail::Write(consoleFormat, std::format(format, std::forward<Args>(args)...));
+        detail::Append([&](std::string& out) {
+            detail::AppendStyled(out, style, [&](std::string& text) { detail::FormatTo(text, format, std::forward<Args>(args)...); });
+        });
     }
 
     template <typename... Args>
-    void Write(const std::initializer_list<Format>& consoleFormat, const std::wformat_string<Args...> format, Args&&... args)
+    void Write(const Style& style, const std::wformat_string<Args...> format, Args&&... args)
     {
-        detail::Write(consoleFormat, Util::to_string(std::format(format, std::forward<Args>(args)...)));
+        detail::Append([&](std::string& out) {
+            detail::AppendStyled(out, style, [&](std::string& text) { detail::FormatTo(text, format, std::forward<Args>(args)...); });
+        });
     }
 
     template <typename... Args>
     void WriteLine(const std::format_string<Args...> format, Args&&... args)
     {
-        // Just forward to std::println
-        std::println(format, std::forward<Args>(args)...);
+        detail::Append([&](std::string& out) {
+            detail::FormatTo(out, format, std::forward<Args>(args)...);
+            out.push_back('\n');
+        });
     }
 
     template <typename... Args>
     void WriteLine(const std::wformat_string<Args...> format, Args&&... args)
     {
-        // std::println does not work on wchar_t (on MSVC), but std::format does.
-        std::println("{}", Util::to_string(std::format(format, std::forward<Args>(args)...)));
+        detail::Append([&](std::string& out) {
+            detail::FormatTo(out, format, std::forward<Args>(args)...);
+            out.push_back('\n');
+        });
     }
 
     template <typename... Args>
-    void WriteLine(const std::initializer_list<Format>& consoleFormat, const std::format_string<Args...> format, Args&&... args)
+    void WriteLine(const Style& style, const std::format_string<Args...> format, Args&&... args)
     {
-        detail::Write(consoleFormat, std::format(format, std::forward<Args>(args)...));
-        std::println("");
+        detail::Append([&](std::string& out) {
+            detail::AppendStyled(out, style, [&](std::string& text) { detail::FormatTo(text, format, std::forward<Args>(args)...); });
+            out.push_back('\n');
+        });
     }
 
     template <typename... Args>
-    void WriteLine(const std::initializer_list<Format>& consoleFormat, const std::wformat_string<Args...> format, Args&&... args)
+    void WriteLine(const Style& style, const std::wformat_string<Args...> format, Args&&... args)
+    {
+        detail::Append([&](std::string& out) {
+            detail::AppendStyled(out, style, [&](std::string& text) { detail::FormatTo(text, format, std::forward<Args>(args)...); });
+            out.push_back('\n');
+        });
+    }
+
+    /*
+      Following WriteLineRaw functions write already formatted UTF-8 text as is.
+    */
+
+    inline void WriteLineRaw(std::string_view text)
+    {
+        detail::Append([text](std::string& out) {
+            out.append(text);
+            out.push_back('\n');
+        });
+    }
+
+    inline void WriteLineRaw(const Style& style, std::string_view text)
     {
-        detail::Write(consoleFormat, Util::to_string(std::format(format, std::forward<Args>(args)...)));
-        std::println("");
+        detail::Append([&](std::string& out) {
+            detail::AppendStyled(out, style, [text](std::string& body) { body.append(text); });
+            out.push_back('\n');
+        });
     }
 
      /*
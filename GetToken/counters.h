@@ -0,0 +1,408 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cwchar>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#ifndef  NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <Windows.h>
+#include <Psapi.h>
+#include <TlHelp32.h>
+
+#include "timing.h"
+#include "trace.h"
+#include "util.h"
+
+// Define GETTOKEN_COUNT_ALLOCATIONS to count the allocations of the whole process in the samples & the summary.
+// It replaces the global operator new & delete, so every allocation costs two more relaxed atomic increments.
+namespace Diagnostics::Counters
+{
+    using Clock = Timing::Clock;
+
+    // Serves the WAM requests for Microsoft accounts & Entra ID. Started on demand, so it may appear or exit during a run
+    inline constexpr auto BrokerProcessName = std::wstring_view{ L"Microsoft.AAD.BrokerPlugin.exe" };
+
+    /// <summary>
+    /// Resource usage of a process at one point in time
+    /// </summary>
+    struct Sample
+    {
+        Clock::time_point Time;
+        std::uint64_t WorkingSet = 0;       // Bytes
+        std::uint64_t PrivateBytes = 0;     // Bytes of private commit
+        std::uint32_t Handles = 0;
+        std::uint32_t Threads = 0;
+        std::uint64_t Allocations = 0;      // operator new calls so far. This process only, with GETTOKEN_COUNT_ALLOCATIONS
+        std::uint64_t LiveAllocations = 0;  // Blocks not deleted yet
+    };
+
+    /// <summary>
+    /// Samples of one process, in the order the processes were first sampled
+    /// </summary>
+    struct ProcessStats
+    {
+        std::string Name;
+        DWORD ProcessId = 0;    // Of the last sample (the broker may have been restarted)
+        std::size_t Count = 0;
+        Sample First;
+        Sample Last;
+        Sample Peak;            // Highest value of each counter
+    };
+
+    inline constexpr bool CountsAllocations() noexcept
+    {
+#ifdef GETTOKEN_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    namespace detail
+    {
+        inline auto _allocations = std::atomic<std::uint64_t>{ 0 };
+        inline auto _frees = std::atomic<std::uint64_t>{ 0 };
+
+        /// <summary>
+        /// Memory & handle counters of the process. Threads are filled in from the process snapshot.
+        /// </summary>
+        inline std::optional<Sample> SampleProcess(HANDLE process) noexcept
+        {
+            auto memory = PROCESS_MEMORY_COUNTERS_EX{ .cb = sizeof(PROCESS_MEMORY_COUNTERS_EX) };
+            auto handles = DWORD{};
+
+            if (not ::GetProcessMemoryInfo(process, reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&memory), sizeof(memory))
+                || not ::GetProcessHandleCount(process, &handles))
+            {
+                return std::nullopt;
+            }
+
+            return Sample{
+                .Time = Clock::now(),
+                .WorkingSet = memory.WorkingSetSize,
+                .PrivateBytes = memory.PrivateUsage,
+                .Handles = handles };
+        }
+
+        inline void Accumulate(ProcessStats& stats, const Sample& sample) noexcept
+        {
+            if (stats.Count++ == 0)
+            {
+                stats.First = sample;
+                stats.Peak = sample;
+            }
+
+            stats.Last = sample;
+
+            auto& peak = stats.Peak;
+            peak.WorkingSet = std::max(peak.WorkingSet, sample.WorkingSet);
+            peak.PrivateBytes = std::max(peak.PrivateBytes, sample.PrivateBytes);
+            peak.Handles = std::max(peak.Handles, sample.Handles);
+            peak.Threads = std::max(peak.Threads, sample.Threads);
+            peak.Allocations = std::max(peak.Allocations, sample.Allocations);
+            peak.LiveAllocations = std::max(peak.LiveAllocations, sample.LiveAllocations);
+        }
+
+        /// <summary>
+        /// Samples this process (and the broker if asked) on a background thread until stopped.
+        /// Each sample is written to the trace as phase "Counters:<process>", with the time the sample took as the duration.
+        /// </summary>
+        class Sampler final
+        {
+        public:
+            Sampler(std::chrono::milliseconds interval, bool includeBroker) :
+                _interval{ interval },
+                _includeBroker{ includeBroker },
+                _name{ Util::GetModulePath(nullptr).stem().string() },
+                _brokerName{ Util::to_string(BrokerProcessName.substr(0, BrokerProcessName.rfind(L'.'))) }
+            {
+                ::ProcessIdToSessionId(::GetCurrentProcessId(), &_sessionId);
+                _thread = std::jthread{ [this](std::stop_token stop) { Run(stop); } };
+            }
+
+            Sampler(const Sampler&) = delete;
+            Sampler& operator=(const Sampler&) = delete;
+
+            ~Sampler()
+            {
+                Stop();
+            }
+
+            /// <summary>
+            /// Stop the thread after a last sample, so that the stats cover the whole run
+            /// </summary>
+            void Stop() noexcept
+            {
+                _thread.request_stop();
+
+                if (_thread.joinable())
+                {
+                    _thread.join();
+                }
+            }
+
+            std::vector<ProcessStats> GetStats() const
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                return _stats;
+            }
+
+        private:
+            void Run(std::stop_token stop)
+            {
+                auto mutex = std::mutex{};
+                auto wakeup = std::condition_variable_any{};
+
+                do
+                {
+                    try
+                    {
+                        SampleAll();
+                    }
+                    catch (...)
+                    {
+                        // Sampling must not affect the run
+                    }
+
+                    auto lock = std::unique_lock{ mutex };
+                    wakeup.wait_for(lock, stop, _interval, [] { return false; });
+                } while (not stop.stop_requested());
+
+                try
+                {
+                    SampleAll();
+                }
+                catch (...)
+                {
+                }
+            }
+
+            void SampleAll()
+            {
+                const auto start = Clock::now();
+
+                // One snapshot gives the thread counts of both processes and finds the broker (file_handle: it fails with INVALID_HANDLE_VALUE)
+                auto snapshot = winrt::file_handle{ ::CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0) };
+                auto threads = std::uint32_t{};
+                auto brokerId = DWORD{};
+                auto brokerThreads = std::uint32_t{};
+
+                if (snapshot)
+                {
+                    auto entry = PROCESSENTRY32W{ .dwSize = sizeof(PROCESSENTRY32W) };
+
+                    for (auto found = ::Process32FirstW(snapshot.get(), &entry); found; found = ::Process32NextW(snapshot.get(), &entry))
+                    {
+                        if (entry.th32ProcessID == ::GetCurrentProcessId())
+                        {
+                            threads = entry.cntThreads;
+                        }
+                        else if (_includeBroker && brokerId == 0 && ::_wcsicmp(entry.szExeFile, BrokerProcessName.data()) == 0 && IsInSession(entry.th32ProcessID))
+                        {
+                            brokerId = entry.th32ProcessID;
+                            brokerThreads = entry.cntThreads;
+                        }
+                    }
+                }
+
+                if (auto sample = SampleProcess(::GetCurrentProcess()))
+                {
+                    sample->Threads = threads;
+                    sample->Allocations = _allocations.load(std::memory_order_relaxed);
+                    sample->LiveAllocations = sample->Allocations - std::min(sample->Allocations, _frees.load(std::memory_order_relaxed));
+                    Record(_name, ::GetCurrentProcessId(), *sample, start);
+                }
+
+                if (_includeBroker && brokerId != 0 && OpenBroker(brokerId))
+                {
+                    if (auto sample = SampleProcess(_broker.get()))
+                    {
+                        sample->Threads = brokerThreads;
+                        Record(_brokerName, brokerId, *sample, start);
+                    }
+                }
+            }
+
+            bool IsInSession(DWORD processId) const noexcept
+            {
+                auto sessionId = DWORD{};
+                return ::ProcessIdToSessionId(processId, &sessionId) && sessionId == _sessionId;
+            }
+
+            /// <summary>
+            /// Keep a handle to the broker, and open the new one when it has been restarted
+            /// </summary>
+            bool OpenBroker(DWORD processId)
+            {
+                if (processId == _brokerId && _broker)
+                {
+                    return true;
+                }
+
+                _broker.attach(::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ, FALSE, processId));
+
+                if (not _broker)
+                {
+                    _broker.attach(::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId));
+                }
+
+                if (not _broker)
+                {
+                    // Once per broker process, not once per sample
+                    if (processId != _brokerId)
+                    {
+                        Trace::Write<Trace::Level::Warning>("Failed to open {} (pid {}) to sample its counters: {:#x}", _brokerName, processId, static_cast<std::uint32_t>(HRESULT_FROM_WIN32(::GetLastError())));
+                    }
+
+                    _brokerId = processId;
+                    return false;
+                }
+
+                _brokerId = processId;
+                return true;
+            }
+
+            void Record(const std::string& name, DWORD processId, const Sample& sample, Clock::time_point start)
+            {
+                {
+                    auto lock = std::scoped_lock{ _mutex };
+                    auto it = std::ranges::find(_stats, name, &ProcessStats::Name);
+
+                    if (it == _stats.end())
+                    {
+                        it = _stats.insert(_stats.end(), ProcessStats{ .Name = name });
+                    }
+
+                    it->ProcessId = processId;
+                    Accumulate(*it, sample);
+                }
+
+                // e.g. "pid=1234 workingSetKB=20480 privateKB=8192 handles=312 threads=14 allocations=53210 liveAllocations=1204"
+                _message.clear();
+                std::format_to(std::back_inserter(_message), "pid={} workingSetKB={} privateKB={} handles={} threads={}",
+                    processId, sample.WorkingSet / 1024, sample.PrivateBytes / 1024, sample.Handles, sample.Threads);
+
+                if (CountsAllocations() && processId == ::GetCurrentProcessId())
+                {
+                    std::format_to(std::back_inserter(_message), " allocations={} liveAllocations={}", sample.Allocations, sample.LiveAllocations);
+                }
+
+                _phase = "Counters:" + name;
+                Trace::WriteDuration(_phase, sample.Time - start, _message);
+            }
+
+            const std::chrono::milliseconds _interval;
+            const bool _includeBroker;
+            const std::string _name;
+            const std::string _brokerName;
+            DWORD _sessionId = 0;
+
+            // Used by the sampling thread only
+            winrt::handle _broker;
+            DWORD _brokerId = 0;
+            std::string _phase;
+            std::string _message;
+
+            mutable std::mutex _mutex;
+            std::vector<ProcessStats> _stats;
+
+            // Last, so that the thread starts after and stops before the members above
+            std::jthread _thread;
+        };
+
+        inline auto _sampler = std::unique_ptr<Sampler>{};
+    }
+
+    /// <summary>
+    /// Start sampling the counters every interval on a background thread. Call once, at startup.
+    /// </summary>
+    /// <param name="includeBroker">Also sample the broker process of this session (see BrokerProcessName) whenever it runs</param>
+    inline void Start(std::chrono::milliseconds interval, bool includeBroker)
+    {
+        detail::_sampler = std::make_unique<detail::Sampler>(interval, includeBroker);
+    }
+
+    /// <summary>
+    /// Take a last sample and stop the sampling thread
+    /// </summary>
+    /// <returns>The stats of every sampled process, or none if sampling was not started</returns>
+    inline std::vector<ProcessStats> Stop() noexcept
+    {
+        try
+        {
+            if (auto sampler = std::move(detail::_sampler))
+            {
+                sampler->Stop();
+                return sampler->GetStats();
+            }
+        }
+        catch (...)
+        {
+        }
+
+        return {};
+    }
+}
+
+#ifdef GETTOKEN_COUNT_ALLOCATIONS
+// Replacements of the global allocation functions (the array & nothrow forms call these by default).
+// Defined in this header because the project has a single translation unit; replacements may not be inline.
+void* operator new(std::size_t size)
+{
+    Diagnostics::Counters::detail::_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    // Same as the default: retry through the new handler until it gives up
+    for (;;)
+    {
+        if (auto p = std::malloc(size == 0 ? 1 : size))
+        {
+            return p;
+        }
+
+        if (const auto handler = std::get_new_handler())
+        {
+            handler();
+        }
+        else
+        {
+            throw std::bad_alloc{};
+        }
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    if (p)
+    {
+        Diagnostics::Counters::detail::_frees.fetch_add(1, std::memory_order_relaxed);
+        std::free(p);
+    }
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+#endif
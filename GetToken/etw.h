@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#ifndef  NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+#include "trace.h"
+
+// Provider "GetToken" {d6fc19c2-c271-546a-9e05-b6211c5a6125}. The GUID is derived from the name (EventSource convention),
+// so tools can also enable it by name, e.g. "wpr -start" with a profile naming "*GetToken", or "tracelog -guid *GetToken".
+// Defined in this header because the project has a single translation unit.
+TRACELOGGING_DEFINE_PROVIDER(
+    g_getTokenEtwProvider,
+    "GetToken",
+    (0xd6fc19c2, 0xc271, 0x546a, 0x9e, 0x05, 0xb6, 0x21, 0x1c, 0x5a, 0x61, 0x25));
+
+namespace Diagnostics::Trace::detail
+{
+    /// <summary>
+    /// Writes messages as TraceLogging events. When no ETW session listens, IsListening() is false and a message is not even formatted.
+    /// Events: "Message" (Message field) and "Duration" (Phase, DurationNs & Message fields), at the level of the message.
+    /// </summary>
+    class EtwTracer final : public ITracer
+    {
+    public:
+        EtwTracer()
+        {
+            const auto hr = ::TraceLoggingRegister(g_getTokenEtwProvider);
+
+            if (FAILED(hr))
+            {
+                throw std::runtime_error{ std::format("TraceLoggingRegister failed with 0x{:08X}", static_cast<std::uint32_t>(hr)) };
+            }
+        }
+
+        ~EtwTracer() override
+        {
+            ::TraceLoggingUnregister(g_getTokenEtwProvider);
+        }
+
+        EtwTracer(const EtwTracer&) = delete;
+        EtwTracer& operator=(const EtwTracer&) = delete;
+
+        void Write(std::string_view message) override
+        {
+            Write(Level::Info, message);
+        }
+
+        void Write(std::string_view phase, std::chrono::nanoseconds duration, std::string_view message) override
+        {
+            TraceLoggingWrite(
+                g_getTokenEtwProvider,
+                "Duration",
+                TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                TraceLoggingCountedUtf8String(phase.data(), static_cast<ULONG>(phase.size()), "Phase"),
+                TraceLoggingInt64(duration.count(), "DurationNs"),
+                TraceLoggingCountedUtf8String(message.data(), static_cast<ULONG>(message.size()), "Message"));
+        }
+
+        void Write(Level level, std::string_view message) override
+        {
+            // TraceLoggingLevel() needs a compile-time constant, hence one TraceLoggingWrite per level
+#define GETTOKEN_ETW_WRITE(etwLevel) \
+            TraceLoggingWrite( \
+                g_getTokenEtwProvider, \
+                "Message", \
+                TraceLoggingLevel(etwLevel), \
+                TraceLoggingCountedUtf8String(message.data(), static_cast<ULONG>(message.size()), "Message"))
+
+            switch (level)
+            {
+            case Level::Error: GETTOKEN_ETW_WRITE(WINEVENT_LEVEL_ERROR); break;
+            case Level::Warning: GETTOKEN_ETW_WRITE(WINEVENT_LEVEL_WARNING); break;
+            case Level::Info: GETTOKEN_ETW_WRITE(WINEVENT_LEVEL_INFO); break;
+            default: GETTOKEN_ETW_WRITE(WINEVENT_LEVEL_VERBOSE); break;
+            }
+
+#undef GETTOKEN_ETW_WRITE
+        }
+
+        bool IsListening(Level level) const noexcept override
+        {
+            return TraceLoggingProviderEnabled(g_getTokenEtwProvider, ToEtwLevel(level), 0);
+        }
+
+    private:
+        static constexpr UCHAR ToEtwLevel(Level level) noexcept
+        {
+            switch (level)
+            {
+            case Level::Error: return WINEVENT_LEVEL_ERROR;
+            case Level::Warning: return WINEVENT_LEVEL_WARNING;
+            case Level::Info: return WINEVENT_LEVEL_INFO;
+            default: return WINEVENT_LEVEL_VERBOSE;
+            }
+        }
+    };
+} // end of namespace Diagnostics::Trace::detail
+
+namespace Diagnostics::Trace
+{
+    /// <summary>
+    /// Also send trace messages to ETW, next to the trace file if there is one. Call at startup, before anything is written.
+    /// </summary>
+    inline void EnableEtw()
+    {
+        detail::AddTracer(std::make_unique<detail::EtwTracer>());
+    }
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace Benchmark
+{
+    using Clock = std::chrono::steady_clock;
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+
+    struct LatencySummary
+    {
+        std::size_t Count = 0;
+        Milliseconds Min{};
+        Milliseconds Mean{};
+        Milliseconds P50{};
+        Milliseconds P90{};
+        Milliseconds P99{};
+        Milliseconds Max{};
+    };
+
+    /// <summary>
+    /// Fixed-size, lock-free latency histogram with log-linear buckets (in the spirit of HdrHistogram).
+    /// Each power of two of nanoseconds is split into SubBucketCount linear buckets, so a value is kept within ~3% of
+    /// its true value at any magnitude. Memory stays constant however many samples are added, and Add() is a few
+    /// relaxed atomic operations, so it can be shared by all the workers of a long soak test.
+    /// Values from 1 ns up to ~4.5 minutes are tracked; longer ones go to the last bucket (Max is still exact).
+    /// </summary>
+    class Histogram final
+    {
+    public:
+        Histogram() = default;
+        Histogram(const Histogram&) = delete;
+        Histogram& operator=(const Histogram&) = delete;
+
+        void Add(Clock::duration latency) noexcept
+        {
+            const auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+
+            _buckets[IndexOf(ns)].fetch_add(1, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _total.fetch_add(ns, std::memory_order_relaxed);
+
+            auto min = _min.load(std::memory_order_relaxed);
+            while (ns < min && not _min.compare_exchange_weak(min, ns, std::memory_order_relaxed)) {}
+
+            auto max = _max.load(std::memory_order_relaxed);
+            while (ns > max && not _max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+        }
+
+        std::size_t Count() const noexcept
+        {
+            return static_cast<std::size_t>(_count.load(std::memory_order_relaxed));
+        }
+
+        /// <summary>
+        /// Summarize the samples added so far. Percentiles are the midpoints of their buckets, clamped to [Min, Max].
+        /// Call it after the writers are done for a consistent result.
+        /// </summary>
+        LatencySummary GetSummary() const
+        {
+            auto summary = LatencySummary{};
+
+            // Snapshot the buckets once, so that the count & the percentiles agree even if writers are still running
+            auto counts = std::array<std::uint64_t, BucketCount>{};
+            auto count = std::uint64_t{ 0 };
+
+            for (std::size_t i = 0; i < BucketCount; ++i)
+            {
+                counts[i] = _buckets[i].load(std::memory_order_relaxed);
+                count += counts[i];
+            }
+
+            if (count == 0)
+            {
+                return summary;
+            }
+
+            const auto min = _min.load(std::memory_order_relaxed);
+            const auto max = _max.load(std::memory_order_relaxed);
+            const auto toMilliseconds = [](std::uint64_t ns) { return Milliseconds{ std::chrono::nanoseconds{ ns } }; };
+
+            // Nearest-rank percentile
+            const auto percentile = [&](double p) {
+                const auto rank = std::clamp<std::uint64_t>(static_cast<std::uint64_t>(p / 100.0 * static_cast<double>(count) + 0.5), 1, count);
+                auto seen = std::uint64_t{ 0 };
+
+                for (std::size_t i = 0; i < BucketCount; ++i)
+                {
+                    seen += counts[i];
+
+                    if (seen >= rank)
+                    {
+                        return toMilliseconds(std::clamp(MidpointOf(i), min, max));
+                    }
+                }
+
+                return toMilliseconds(max);
+            };
+
+            summary.Count = static_cast<std::size_t>(count);
+            summary.Min = toMilliseconds(min);
+            summary.Mean = toMilliseconds(_total.load(std::memory_order_relaxed)) / static_cast<double>(_count.load(std::memory_order_relaxed));
+            summary.P50 = percentile(50);
+            summary.P90 = percentile(90);
+            summary.P99 = percentile(99);
+            summary.Max = toMilliseconds(max);
+
+            return summary;
+        }
+
+    private:
+        static constexpr int SubBucketBits = 5;
+        static constexpr std::uint64_t SubBucketCount = 1ull << SubBucketBits;
+
+        // Top tracked magnitude: 2^38 ns (~4.5 minutes)
+        static constexpr int MaxBits = 38;
+        static constexpr std::size_t BucketCount = (MaxBits - SubBucketBits + 1) * SubBucketCount;
+
+        // Values below SubBucketCount get a bucket each.
+        // Above that, the bucket is picked by the position of the highest bit and the next SubBucketBits bits.
+        static constexpr std::size_t IndexOf(std::uint64_t ns) noexcept
+        {
+            if (ns < SubBucketCount)
+            {
+                return static_cast<std::size_t>(ns);
+            }
+
+            const auto shift = std::bit_width(ns) - 1 - SubBucketBits;
+            const auto index = static_cast<std::size_t>((shift + 1) * SubBucketCount + ((ns >> shift) - SubBucketCount));
+
+            return std::min(index, BucketCount - 1);
+        }
+
+        static constexpr std::uint64_t MidpointOf(std::size_t index) noexcept
+        {
+            const auto group = index / SubBucketCount;
+
+            if (group == 0)
+            {
+                return index;
+            }
+
+            const auto shift = group - 1;
+            const auto lower = (SubBucketCount + index % SubBucketCount) << shift;
+            return lower + ((1ull << shift) >> 1);
+        }
+
+        std::array<std::atomic<std::uint64_t>, BucketCount> _buckets{};
+        std::atomic<std::uint64_t> _count{ 0 };
+        std::atomic<std::uint64_t> _total{ 0 };
+        std::atomic<std::uint64_t> _min{ std::numeric_limits<std::uint64_t>::max() };
+        std::atomic<std::uint64_t> _max{ 0 };
+    };
+}
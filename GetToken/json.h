@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "util.h"
+
+namespace Json
+{
+    namespace detail
+    {
+        inline bool NeedsEscape(const char c) noexcept
+        {
+            return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+        }
+
+        /// <summary>
+        /// Append text as the body of a JSON string. Runs of characters that need no escaping are appended at once.
+        /// </summary>
+        inline void AppendEscaped(std::string& out, std::string_view text)
+        {
+            constexpr char hex[] = "0123456789abcdef";
+
+            while (not text.empty())
+            {
+                auto run = std::size_t{ 0 };
+
+                while (run < text.size() && not NeedsEscape(text[run]))
+                {
+                    ++run;
+                }
+
+                out.append(text.data(), run);
+                text.remove_prefix(run);
+
+                if (text.empty())
+                {
+                    break;
+                }
+
+                const auto c = text.front();
+                text.remove_prefix(1);
+
+                switch (c)
+                {
+                case '"': out.append("\\\""); break;
+                case '\\': out.append("\\\\"); break;
+                case '\n': out.append("\\n"); break;
+                case '\r': out.append("\\r"); break;
+                case '\t': out.append("\\t"); break;
+                default:
+                    out.append("\\u00");
+                    out.push_back(hex[(c >> 4) & 0xF]);
+                    out.push_back(hex[c & 0xF]);
+                    break;
+                }
+            }
+        }
+    }
+
+    /// <summary>
+    /// Minimal JSON writer that appends straight into a caller-owned buffer, so the buffer's capacity is reused across records.
+    /// Values are written without intermediate strings: numbers with std::to_chars, wide strings converted in place.
+    /// The caller is responsible for the structure (e.g. a Key before each value in an object).
+    /// </summary>
+    class Writer final
+    {
+    public:
+        explicit Writer(std::string& out) noexcept : _out{ out }
+        {}
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        Writer& BeginObject()
+        {
+            Separate();
+            _out.push_back('{');
+            _needComma = false;
+            return *this;
+        }
+
+        Writer& EndObject()
+        {
+            _out.push_back('}');
+            _needComma = true;
+            return *this;
+        }
+
+        Writer& Key(std::string_view key)
+        {
+            Separate();
+            _out.push_back('"');
+            detail::AppendEscaped(_out, key);
+            _out.append("\":");
+            _needComma = false;
+            return *this;
+        }
+
+        Writer& Key(std::wstring_view key)
+        {
+            Separate();
+            AppendQuoted(key);
+            _out.push_back(':');
+            _needComma = false;
+            return *this;
+        }
+
+        Writer& String(std::string_view value)
+        {
+            Separate();
+            _out.push_back('"');
+            detail::AppendEscaped(_out, value);
+            _out.push_back('"');
+            _needComma = true;
+            return *this;
+        }
+
+        Writer& String(std::wstring_view value)
+        {
+            Separate();
+            AppendQuoted(value);
+            _needComma = true;
+            return *this;
+        }
+
+        Writer& Number(std::int64_t value)
+        {
+            Separate();
+            char buffer[24];
+            const auto [end, ec] = std::to_chars(std::begin(buffer), std::end(buffer), value);
+            _out.append(buffer, end);
+            _needComma = true;
+            return *this;
+        }
+
+        /// <param name="precision">Digits after the decimal point</param>
+        Writer& Number(double value, int precision = 3)
+        {
+            Separate();
+            char buffer[64];
+            const auto [end, ec] = std::to_chars(std::begin(buffer), std::end(buffer), value, std::chars_format::fixed, precision);
+
+            // Not representable in 64 chars (or not finite): JSON has no such numbers
+            if (ec != std::errc{})
+            {
+                _out.append("null");
+            }
+            else
+            {
+                _out.append(buffer, end);
+            }
+
+            _needComma = true;
+            return *this;
+        }
+
+        Writer& Bool(bool value)
+        {
+            Separate();
+            _out.append(value ? "true" : "false");
+            _needComma = true;
+            return *this;
+        }
+
+        Writer& Null()
+        {
+            Separate();
+            _out.append("null");
+            _needComma = true;
+            return *this;
+        }
+
+        // Shorthands for "key":value
+        template <typename T>
+        Writer& Field(std::string_view key, const T& value)
+        {
+            Key(key);
+
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                return Bool(value);
+            }
+            else if constexpr (std::is_floating_point_v<T>)
+            {
+                return Number(static_cast<double>(value));
+            }
+            else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+            {
+                return Number(static_cast<std::int64_t>(value));
+            }
+            else if constexpr (std::is_convertible_v<const T&, std::wstring_view>)
+            {
+                return String(std::wstring_view{ value });
+            }
+            else
+            {
+                return String(std::string_view{ value });
+            }
+        }
+
+    private:
+        void Separate()
+        {
+            if (_needComma)
+            {
+                _out.push_back(',');
+            }
+        }
+
+        void AppendQuoted(std::wstring_view text)
+        {
+            _out.push_back('"');
+
+            // Convert into the buffer, then escape only if the converted text needs it (rare)
+            const auto start = _out.size();
+            Util::to_string(text, _out);
+
+            const auto converted = std::string_view{ _out }.substr(start);
+
+            if (std::ranges::any_of(converted, detail::NeedsEscape))
+            {
+                thread_local auto scratch = std::string{};
+                scratch.assign(converted);
+                _out.resize(start);
+                detail::AppendEscaped(_out, scratch);
+            }
+
+            _out.push_back('"');
+        }
+
+        std::string& _out;
+        bool _needComma = false;
+    };
+
+    /// <summary>
+    /// Build one JSON object with "fill(Json::Writer&)" in a per-thread buffer and write it to stdout as a single line (JSON Lines).
+    /// One fwrite per record, so records from different threads do not interleave.
+    /// </summary>
+    template <typename F>
+    void WriteLine(F&& fill)
+    {
+        thread_local auto buffer = std::string{};
+        buffer.clear();
+
+        auto writer = Writer{ buffer };
+        writer.BeginObject();
+        fill(writer);
+        writer.EndObject();
+        buffer.push_back('\n');
+
+        std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+    }
+}
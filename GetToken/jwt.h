@@ -0,0 +1,199 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Jwt
+{
+    /// <summary>
+    /// Registered time claims of a JWT (seconds since the Unix epoch)
+    /// https://datatracker.ietf.org/doc/html/rfc7519#section-4.1
+    /// </summary>
+    struct Claims
+    {
+        std::optional<std::int64_t> IssuedAt;   // iat
+        std::optional<std::int64_t> NotBefore;  // nbf
+        std::optional<std::int64_t> Expires;    // exp
+    };
+
+    /// <summary>
+    /// How old a token is and how long it stays valid, at a given time
+    /// </summary>
+    struct Lifetime
+    {
+        std::optional<std::chrono::seconds> Age;        // now - iat
+        std::optional<std::chrono::seconds> Remaining;  // exp - now (negative if expired)
+    };
+
+    namespace detail
+    {
+        inline constexpr auto InvalidSextet = std::uint8_t{ 0xFF };
+
+        // base64url alphabet: A-Z a-z 0-9 - _
+        // https://datatracker.ietf.org/doc/html/rfc4648#section-5
+        inline constexpr auto DecodeTable = []() {
+            auto table = std::array<std::uint8_t, 128>{};
+            table.fill(InvalidSextet);
+
+            for (int i = 0; i < 26; ++i)
+            {
+                table['A' + i] = static_cast<std::uint8_t>(i);
+                table['a' + i] = static_cast<std::uint8_t>(26 + i);
+            }
+
+            for (int i = 0; i < 10; ++i)
+            {
+                table['0' + i] = static_cast<std::uint8_t>(52 + i);
+            }
+
+            table['-'] = 62;
+            table['_'] = 63;
+            return table;
+        }();
+
+        /// <summary>
+        /// Decode base64url (padding optional) straight from the UTF-16 token into out.
+        /// </summary>
+        /// <returns>false on an invalid character</returns>
+        inline bool DecodeBase64Url(std::wstring_view input, std::string& out)
+        {
+            while (not input.empty() && input.back() == L'=')
+            {
+                input.remove_suffix(1);
+            }
+
+            out.clear();
+            out.reserve(input.size() * 3 / 4);
+
+            auto bits = std::uint32_t{ 0 };
+            auto bitCount = 0;
+
+            for (const auto c : input)
+            {
+                const auto sextet = c < DecodeTable.size() ? DecodeTable[c] : InvalidSextet;
+
+                if (sextet == InvalidSextet)
+                {
+                    return false;
+                }
+
+                bits = (bits << 6) | sextet;
+                bitCount += 6;
+
+                if (bitCount >= 8)
+                {
+                    bitCount -= 8;
+                    out.push_back(static_cast<char>((bits >> bitCount) & 0xFF));
+                }
+            }
+
+            return true;
+        }
+
+        /// <summary>
+        /// Find a numeric member of a JSON object by name, e.g. "exp": 1700000000.
+        /// Minimal by design: it does not parse the whole document, it looks for "name" followed by a colon.
+        /// A string value that happens to equal the name is skipped because no colon follows it.
+        /// </summary>
+        inline std::optional<std::int64_t> FindNumber(std::string_view json, std::string_view name)
+        {
+            auto pos = std::size_t{ 0 };
+
+            while ((pos = json.find(name, pos)) != std::string_view::npos)
+            {
+                const auto begin = pos;
+                pos += name.size();
+
+                if (begin == 0 || json[begin - 1] != '"' || pos >= json.size() || json[pos] != '"')
+                {
+                    continue;
+                }
+
+                auto cursor = json.find_first_not_of(" \t\r\n", pos + 1);
+
+                if (cursor == std::string_view::npos || json[cursor] != ':')
+                {
+                    continue;
+                }
+
+                cursor = json.find_first_not_of(" \t\r\n", cursor + 1);
+
+                if (cursor == std::string_view::npos)
+                {
+                    return std::nullopt;
+                }
+
+                // NumericDate may have a fraction; the integer part is enough here
+                auto value = std::int64_t{};
+                const auto [end, ec] = std::from_chars(json.data() + cursor, json.data() + json.size(), value);
+
+                if (ec == std::errc{})
+                {
+                    return value;
+                }
+
+                return std::nullopt;
+            }
+
+            return std::nullopt;
+        }
+    }
+
+    /// <summary>
+    /// Decode the time claims from the payload of a JWS compact serialization (header.payload.signature).
+    /// The token is read in place; only the payload is decoded, into a per-thread buffer.
+    /// </summary>
+    /// <returns>nullopt if the token is not a JWT (e.g. an opaque token)</returns>
+    inline std::optional<Claims> DecodeClaims(std::wstring_view token)
+    {
+        const auto first = token.find(L'.');
+
+        if (first == std::wstring_view::npos)
+        {
+            return std::nullopt;
+        }
+
+        const auto second = token.find(L'.', first + 1);
+
+        if (second == std::wstring_view::npos)
+        {
+            return std::nullopt;
+        }
+
+        thread_local auto payload = std::string{};
+
+        if (not detail::DecodeBase64Url(token.substr(first + 1, second - first - 1), payload))
+        {
+            return std::nullopt;
+        }
+
+        return Claims{
+            .IssuedAt = detail::FindNumber(payload, "iat"),
+            .NotBefore = detail::FindNumber(payload, "nbf"),
+            .Expires = detail::FindNumber(payload, "exp")
+        };
+    }
+
+    inline Lifetime GetLifetime(const Claims& claims, const std::chrono::system_clock::time_point now = std::chrono::system_clock::now())
+    {
+        const auto nowSeconds = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch());
+        auto lifetime = Lifetime{};
+
+        if (claims.IssuedAt)
+        {
+            lifetime.Age = nowSeconds - std::chrono::seconds{ *claims.IssuedAt };
+        }
+
+        if (claims.Expires)
+        {
+            lifetime.Remaining = std::chrono::seconds{ *claims.Expires } - nowSeconds;
+        }
+
+        return lifetime;
+    }
+}
@@ -1,51 +1,264 @@
 ﻿#include "pch.h"
 
+#include "bench.h"
+#include "benchmark.h"
 #include "console.h"
+#include "counters.h"
+#include "etw.h"
+#include "json.h"
+#include "jwt.h"
 #include "option.h"
+#include "pipe.h"
+#include "redact.h"
+#include "request.h"
+#include "retry.h"
+#include "scheduler.h"
+#include "session.h"
+#include "span.h"
+#include "timing.h"
 #include "trace.h"
 #include "util.h"
 #include "wam.h"
+#include "wamclient.h"
 
 using namespace winrt;
 using namespace Windows::Foundation;
 using namespace Windows::Security::Credentials;
 using namespace Windows::Security::Authentication::Web::Core;
 using namespace Diagnostics;
+using Diagnostics::Timing::ScopedTimer;
+using Diagnostics::Trace::Level;
+
+// Outcome of one request of a batch (see RunBatchAsync)
+struct BatchResult
+{
+    winrt::hstring Scopes;
+    WebTokenRequest Request{ nullptr };
+    WebTokenRequestResult Result{ nullptr };
+    Benchmark::Clock::duration Latency{};
+    std::optional<winrt::hresult_error> Error;
+};
+
+struct SignOutResult
+{
+    winrt::hstring UserName;
+    Benchmark::Clock::duration Latency{};
+    std::optional<winrt::hresult_error> Error;
+};
+
+// Outcome of the request for one account of an --allaccounts run (see RunAllAccountsAsync)
+struct AccountResult
+{
+    WebAccount Account{ nullptr };
+    WebTokenRequest Request{ nullptr };
+    WebTokenRequestResult Result{ nullptr };
+    Benchmark::Clock::duration Latency{};
+    std::optional<winrt::hresult_error> Error;
+};
+
+// Shared by the workers of a --requestfile run (see RunRequestFileAsync)
+struct RequestFileRun
+{
+    explicit RequestFileRun(const std::filesystem::path& path) : Reader{ path }
+    {}
+
+    WAM::RequestReader Reader;
+    std::mutex ReaderMutex;
+    std::atomic<bool> Stopped{ false };     // Set when the input cannot be read any further
+    Benchmark::Histogram Latency;
+    std::atomic<int> Succeeded{ 0 };
+    std::atomic<int> Failed{ 0 };
+};
+
+class AnchorWindow;
 
 // Forward declarations
 auto ParseOption(int argc, char** argv) noexcept -> std::expected<Option, std::string>;
 void EnableTrace(const Option& option) noexcept;
-auto MainAsync(const Option& option, const HWND hwnd) -> IAsyncOperation<int>;
+int ConvertTrace(const std::filesystem::path& binaryPath) noexcept;
+auto MainAsync(const Option& option, AnchorWindow& anchor) -> IAsyncOperation<int>;
+auto RequestTokenSilentlyAsync(WAM::Session& session, const Option& option, WebAccountProvider provider) -> IAsyncOperation<int>;
+auto RequestTokenInteractivelyAsync(WAM::Session& session, const Option& option, WebAccountProvider provider, AnchorWindow& anchor) -> IAsyncOperation<int>;
 auto GetWebTokenRequest(const WebAccountProvider& provider, WebTokenRequestPromptType promptType, const Option& option) -> WebTokenRequest;
-auto InvokeRequestTokenAsync(const WebTokenRequest& request, HWND hwnd) -> IAsyncOperation<WebTokenRequestResult>;
+auto GetWebTokenRequest(const WebAccountProvider& provider, WebTokenRequestPromptType promptType, const Option& option, const winrt::hstring& scopes) -> WebTokenRequest;
+auto GetWebTokenRequest(const WebAccountProvider& provider, WebTokenRequestPromptType promptType, const winrt::hstring& clientId, const winrt::hstring& scopes, const std::unordered_map<winrt::hstring, winrt::hstring>& properties) -> WebTokenRequest;
+auto InvokeGetTokenSilentlyAsync(WAM::IWamClient& wam, const WebTokenRequest& request, const WebAccount& account, const Retry::Policy& policy) -> IAsyncOperation<WebTokenRequestResult>;
+auto InvokeRequestTokenAsync(WAM::IWamClient& wam, const WebTokenRequest& request, HWND hwnd, const Retry::Policy& policy) -> IAsyncOperation<WebTokenRequestResult>;
+void SetSpanResult(Spans::ScopedSpan& span, const WebTokenRequestResult& result) noexcept;
+auto GetRetryPolicy(const Option& option) -> Retry::Policy;
+auto GetWamClient(const Option& option) -> std::shared_ptr<WAM::IWamClient>;
+auto RunLoadTestAsync(WAM::Session& session, const Option& option) -> IAsyncOperation<int>;
+auto LoadTestWorkerAsync(WAM::Session& session, const Option& option, Benchmark::LoadTest& loadTest) -> IAsyncAction;
+auto RunBatchAsync(WAM::Session& session, const Option& option) -> IAsyncOperation<int>;
+auto RunRequestFileAsync(WAM::Session& session, const Option& option, AnchorWindow& anchor) -> IAsyncOperation<int>;
+auto RunAllAccountsAsync(WAM::Session& session, const Option& option) -> IAsyncOperation<int>;
+auto AccountRequestAsync(WAM::Session& session, AccountResult& result) -> IAsyncAction;
+auto RunBenchAsync(const Option& option) -> IAsyncOperation<int>;
+void PrintBenchResults(const Option& option, const std::vector<Benchmark::ScenarioResult>& results, const std::vector<Benchmark::Comparison>& comparisons) noexcept;
+auto RequestFileWorkerAsync(WAM::Session& session, const Option& option, AnchorWindow& anchor, RequestFileRun& run) -> IAsyncAction;
+auto BatchRequestAsync(WAM::IWamClient& wam, WebTokenRequest request, WebAccount account, const Retry::Policy& policy, BatchResult& result) -> IAsyncAction;
+auto SignOutAccountsAsync(WAM::IWamClient& wam, const Collections::IVectorView<WebAccount> accounts, const Option& option) -> IAsyncAction;
+auto SignOutAccountAsync(WAM::IWamClient& wam, WebAccount account, SignOutResult& result) -> IAsyncAction;
+auto ServeAsync(const Option& option, AnchorWindow& anchor) -> IAsyncOperation<int>;
+auto HandleClientAsync(winrt::file_handle pipe, HANDLE stop, WAM::Session& session, const Option& option, AnchorWindow& anchor) -> IAsyncAction;
+int RunClient(const Option& option) noexcept;
 HWND CreateAnchorWindow();
 void PrintWebAccount(const WebAccount& account) noexcept;
 void PrintWebTokenResponse(const WebTokenResponse& response) noexcept;
 void PrintProviderError(const WebProviderError& error) noexcept;
+auto GetTokenLifetime(const WebTokenResponse& response) noexcept -> std::optional<Jwt::Lifetime>;
+void PrintTimingSummary() noexcept;
+void PrintCounterSummary(const Option& option, const std::vector<Counters::ProcessStats>& stats) noexcept;
+void WriteJsonRecord(std::string_view phase, Benchmark::Clock::duration duration, const WebTokenRequest& request, const WebTokenRequestResult& result) noexcept;
+void WriteJsonRecord(std::string_view phase, const winrt::hresult_error& error) noexcept;
+void WriteJsonRecord(const Retry::Attempt& attempt) noexcept;
 
 // Logger writes to both console & trace file
 namespace Logger
 {
-    template <typename... Args>
+    template <Level level = Level::Info, typename... Args>
     void WriteLine(const std::format_string<Args...> format, Args&&... args) noexcept;
 
-    template <typename... Args>
-    void WriteLine(const std::initializer_list<Console::Format>& consoleFormat, const std::format_string<Args...> format, Args&&... args) noexcept;
+    template <Level level = Level::Info, typename... Args>
+    void WriteLine(const Console::Style& consoleFormat, const std::format_string<Args...> format, Args&&... args) noexcept;
 
-    template <typename... Args>
+    template <Level level = Level::Info, typename... Args>
     void WriteLine(const std::wformat_string<Args...> format, Args&&... args) noexcept;
 
-    template <typename... Args>
-    void WriteLine(const std::initializer_list<Console::Format>& consoleFormat, const std::wformat_string<Args...> format, Args&&... args) noexcept;
+    template <Level level = Level::Info, typename... Args>
+    void WriteLine(const Console::Style& consoleFormat, const std::wformat_string<Args...> format, Args&&... args) noexcept;
+
+    // Turn off the console side (e.g. while stdout carries JSON Lines). The trace side is not affected.
+    void EnableConsole(bool enable) noexcept;
 }
 
 namespace ConsoleFormat
 {
-    constexpr auto Error = { Console::Format::ForegroundRed, Console::Format::Bright };
-    constexpr auto Warning = { Console::Format::ForegroundYellow, Console::Format::Bright };
-    constexpr auto Verbose = { Console::Format::ForegroundCyan };
+    // The escape sequences are built at compile time
+    constexpr auto Error = Console::Style{ Console::Format::ForegroundRed, Console::Format::Bright };
+    constexpr auto Warning = Console::Style{ Console::Format::ForegroundYellow, Console::Format::Bright };
+    constexpr auto Verbose = Console::Style{ Console::Format::ForegroundCyan };
+    constexpr auto Default = Console::Style{ Console::Format::Default };
 }
 
+// Thread messages handled by the message loop in main()
+constexpr auto WM_CREATE_ANCHOR = UINT{ WM_APP + 1 };   // lParam: AnchorWindow*
+constexpr auto WM_TASK_COMPLETED = UINT{ WM_APP + 2 };
+constexpr auto WM_RESUME_COROUTINE = UINT{ WM_APP + 3 };  // lParam: std::coroutine_handle<>::address()
+
+/// <summary>
+/// The invisible window that RequestTokenAsync's UI is anchored to. It is created by the first interactive request,
+/// so runs without one (e.g. --showaccounts & --mode silent) skip RegisterClassExW & CreateWindowExW entirely.
+/// The window must belong to the message loop thread: Get() from another thread asks the loop to create it and waits,
+/// and RequestTokenForWindowAsync must be called there too: co_await ResumeOnLoopThread() first.
+/// </summary>
+class AnchorWindow final
+{
+public:
+    // Construct on the message loop thread
+    AnchorWindow() noexcept : _threadId{ ::GetCurrentThreadId() }
+    {}
+
+    AnchorWindow(const AnchorWindow&) = delete;
+    AnchorWindow& operator=(const AnchorWindow&) = delete;
+
+    ~AnchorWindow()
+    {
+        if (_hwnd)
+        {
+            ::DestroyWindow(_hwnd);
+        }
+    }
+
+    HWND Get()
+    {
+        auto lock = std::unique_lock{ _mutex };
+
+        if (not _hwnd && not _error)
+        {
+            if (::GetCurrentThreadId() == _threadId)
+            {
+                Create();
+            }
+            else
+            {
+                winrt::check_bool(::PostThreadMessageW(_threadId, WM_CREATE_ANCHOR, 0, reinterpret_cast<LPARAM>(this)));
+                _created.wait(lock, [this] { return _hwnd || _error; });
+            }
+        }
+
+        if (_error)
+        {
+            std::rethrow_exception(_error);
+        }
+
+        return _hwnd;
+    }
+
+    /// <summary>
+    /// Awaitable that resumes the coroutine on the message loop thread (at once if it is already there), via WM_RESUME_COROUTINE.
+    /// The main thread is in the MTA like the thread pool, so winrt::apartment_context would not switch threads.
+    /// </summary>
+    auto ResumeOnLoopThread() const noexcept
+    {
+        struct Awaiter
+        {
+            DWORD ThreadId;
+
+            bool await_ready() const noexcept
+            {
+                return ::GetCurrentThreadId() == ThreadId;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) const
+            {
+                winrt::check_bool(::PostThreadMessageW(ThreadId, WM_RESUME_COROUTINE, 0, reinterpret_cast<LPARAM>(handle.address())));
+            }
+
+            void await_resume() const noexcept
+            {}
+        };
+
+        return Awaiter{ _threadId };
+    }
+
+    // Handles WM_CREATE_ANCHOR on the message loop thread
+    void OnCreateMessage() noexcept
+    {
+        {
+            auto lock = std::scoped_lock{ _mutex };
+
+            if (not _hwnd && not _error)
+            {
+                Create();
+            }
+        }
+
+        _created.notify_all();
+    }
+
+private:
+    void Create() noexcept
+    {
+        auto timer = ScopedTimer{ "CreateAnchorWindow" };
+
+        try
+        {
+            _hwnd = CreateAnchorWindow();
+        }
+        catch (...)
+        {
+            _error = std::current_exception();
+        }
+    }
+
+    const DWORD _threadId;
+    std::mutex _mutex;
+    std::condition_variable _created;
+    HWND _hwnd = nullptr;
+    std::exception_ptr _error;
+};
+
 int main(int argc, char** argv)
 {
     std::ios_base::sync_with_stdio(false);
@@ -63,7 +276,19 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    Console::WriteLine(ConsoleFormat::Verbose, "{}", option->GetVersion());
+    // With --output jsonl, stdout carries nothing but JSON records, and what is still written to the console (e.g. errors) goes to stderr
+    if (option->Output() == OutputFormat::JsonLines)
+    {
+        Logger::EnableConsole(false);
+        Console::UseStandardError();
+    }
+    else
+    {
+        Console::WriteLine(ConsoleFormat::Verbose, "{}", option->GetVersion());
+    }
+
+    Trace::SetLevel(option->LogLevel().value_or(Level::Verbose));
+    Redact::SetPolicy(option->RedactPolicy());
 
     if (option->Help())
     {
@@ -76,54 +301,165 @@ int main(int argc, char** argv)
         return EXIT_SUCCESS;
     }
 
+    if (option->ConvertPath())
+    {
+        return ConvertTrace(*option->ConvertPath());
+    }
+
+    // The client only talks to the pipe, so it skips the trace, the anchor window & WAM entirely
+    if (option->Client())
+    {
+        return RunClient(*option);
+    }
+
     if (option->EnableTrace())
     {
         EnableTrace(*option);
     }
 
+    // After the trace file, so that ETW is added next to it
+    if (option->Etw())
+    {
+        try
+        {
+            Trace::EnableEtw();
+        }
+        catch (const std::exception& e)
+        {
+            Console::WriteLine(ConsoleFormat::Error, "Failed to register the ETW provider. {}", e.what());
+        }
+    }
+
     Trace::Write("{}", option->GetVersion());
     Trace::Write("CommandLine: {}", GetCommandLineA());
 
     auto currentUser = Util::GetCurrentUserName();
     Trace::Write("Current User: {}", currentUser.has_value() ? currentUser.value() : currentUser.error());
 
+    if (option->CounterInterval().count() > 0)
+    {
+        try
+        {
+            Counters::Start(option->CounterInterval(), option->CounterBroker());
+        }
+        catch (const std::exception& e)
+        {
+            Console::WriteLine(ConsoleFormat::Error, "Failed to start sampling the resource counters. {}", e.what());
+        }
+    }
+
+    if (option->ChromeTracePath())
+    {
+        Spans::EnableExport();
+    }
+
+    auto waited = Benchmark::Clock::duration{};
+
     if (option->Wait())
     {
+        const auto waitStart = Benchmark::Clock::now();
         Console::Write(ConsoleFormat::Warning, "Hit enter to continue...");
         std::cin.ignore();
+        waited = Benchmark::Clock::now() - waitStart;
     }
 
     // RequestTokenAsync() needs to run on a UI thread
     // Note: I could simply use the console window:
     //   auto hwnd = GetAncestor(GetConsoleWindow(), GA_ROOTOWNER);
-    // However, use a separate invisible window for more control.
-    auto hwnd = CreateAnchorWindow();
+    // However, use a separate invisible window for more control. It is created on the first interactive request.
+    auto anchor = AnchorWindow{};
+    const auto threadId = GetCurrentThreadId();
 
-    // Start the main async task.
-    // When the task completes, destroy the window to exit message loop
-    auto task = MainAsync(*option, hwnd);
-    task.Completed([hwnd](auto&& /*async*/, AsyncStatus /*status*/) { SendMessage(hwnd, WM_DESTROY, 0, 0); });
+    // Create this thread's message queue before anything can post to it
+    auto msg = MSG{};
+    PeekMessageW(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE);
+
+    // From process creation to just before the first WAM call, i.e. the cold-start cost (not counting --wait).
+    // The anchor window is created later by the first interactive request, and is timed as CreateAnchorWindow.
+    const auto startup = Util::GetProcessUptime() - waited;
+    Timing::Record("Startup", startup);
+    Logger::WriteLine<Level::Verbose>(ConsoleFormat::Verbose, "Startup took {:.3f} ms", Benchmark::Milliseconds{ startup }.count());
+
+    // Start the main async task (or the server, which keeps the same window & message loop for all requests).
+    // When the task completes, tell the message loop to exit
+    auto task = option->Serve() ? ServeAsync(*option, anchor)
+        : option->Bench() ? RunBenchAsync(*option)
+        : MainAsync(*option, anchor);
+    task.Completed([threadId](auto&& /*async*/, AsyncStatus /*status*/) { PostThreadMessageW(threadId, WM_TASK_COMPLETED, 0, 0); });
 
     // Run the message loop till the async task completes.
-    auto msg = MSG{};
     auto bRet = BOOL{};
 
     while ((bRet = GetMessage(&msg, nullptr, 0, 0)) != 0)
     {
+        // Thread messages have no window to be dispatched to
+        if (msg.hwnd == nullptr && msg.message == WM_CREATE_ANCHOR)
+        {
+            reinterpret_cast<AnchorWindow*>(msg.lParam)->OnCreateMessage();
+            continue;
+        }
+
+        if (msg.hwnd == nullptr && msg.message == WM_RESUME_COROUTINE)
+        {
+            std::coroutine_handle<>::from_address(reinterpret_cast<void*>(msg.lParam)).resume();
+            continue;
+        }
+
+        if (msg.hwnd == nullptr && msg.message == WM_TASK_COMPLETED)
+        {
+            PostQuitMessage(0);
+            continue;
+        }
+
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
 
+    PrintTimingSummary();
+    PrintCounterSummary(*option, Counters::Stop());
+
+    if (const auto& path = option->ChromeTracePath())
+    {
+        try
+        {
+            const auto count = Spans::WriteChromeTrace(*path);
+            Logger::WriteLine("Wrote {} request spans to {}", count, path->string());
+        }
+        catch (const std::exception& e)
+        {
+            Console::WriteLine(ConsoleFormat::Error, "{}", e.what());
+        }
+    }
+
     return task.GetResults();
 }
 
-IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
+IAsyncOperation<int> MainAsync(const Option& option, AnchorWindow& anchor)
 {
-    const auto& provider = co_await WebAuthenticationCoreManager::FindAccountProviderAsync(WAM::ProviderId::MICROSOFT, WAM::Authority::ORGANIZATION);
+    // Provider & accounts are looked up once and reused for the rest of the process
+    const auto jsonLines = option.Output() == OutputFormat::JsonLines;
+    auto session = WAM::Session{ GetRetryPolicy(option), GetWamClient(option) };
+
+    auto start = Benchmark::Clock::now();
+    const auto provider = co_await session.GetProviderAsync();
+
+    if (jsonLines)
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", "FindAccountProviderAsync")
+                .Field("status", provider ? "Found" : "NotFound")
+                .Field("durationMs", Benchmark::Milliseconds{ Benchmark::Clock::now() - start }.count());
+
+            if (provider)
+            {
+                json.Field("providerId", provider.Id());
+            }
+        });
+    }
 
     if (not provider)
     {
-        Logger::WriteLine(ConsoleFormat::Error, LR"(FindAccountProviderAsync failed to find Provider "{}")", WAM::ProviderId::MICROSOFT);
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, LR"(FindAccountProviderAsync failed to find Provider "{}")", WAM::ProviderId::MICROSOFT);
         co_return EXIT_FAILURE;
     }
 
@@ -137,9 +473,28 @@ IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
     */
     const auto clientId = option.ClientId().value_or(WAM::ClientId::MSOFFICE);
 
-    const auto& findResults = co_await WebAuthenticationCoreManager::FindAllAccountsAsync(provider, clientId);
+    start = Benchmark::Clock::now();
+    const auto findResults = co_await session.FindAllAccountsAsync(provider, clientId);
     auto accountsStatus = findResults.Status();
 
+    if (jsonLines)
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", "FindAllAccountsAsync")
+                .Field("status", to_string(accountsStatus))
+                .Field("durationMs", Benchmark::Milliseconds{ Benchmark::Clock::now() - start }.count());
+
+            if (accountsStatus == FindAllWebAccountsStatus::Success)
+            {
+                json.Field("accountCount", findResults.Accounts().Size());
+            }
+            else if (const auto error = findResults.ProviderError())
+            {
+                json.Field("errorCode", static_cast<std::uint32_t>(error.ErrorCode())).Field("errorMessage", error.ErrorMessage());
+            }
+        });
+    }
+
     if (accountsStatus == FindAllWebAccountsStatus::Success)
     {
         auto accounts = findResults.Accounts();
@@ -153,22 +508,26 @@ IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
             Logger::WriteLine("Found {} web account(s):", accounts.Size());
         }
 
-        // Print account properties
-        for (const auto& account : accounts)
+        // Print account properties, in one console write (the block must end before the next co_await)
         {
-            PrintWebAccount(account);
-            Logger::WriteLine("");
+            auto block = Console::Block{};
 
-            if (option.SignOut())
+            for (const auto& account : accounts)
             {
-                Logger::WriteLine(ConsoleFormat::Warning, "  Signing out from this account ... ");
-                account.SignOutAsync().get();
+                PrintWebAccount(account);
+                Logger::WriteLine("");
             }
         }
+
+        if (option.SignOut() && accounts.Size() > 0)
+        {
+            co_await SignOutAccountsAsync(session.Wam(), accounts, option);
+            session.Invalidate();
+        }
     }
     else
     {
-        Logger::WriteLine(ConsoleFormat::Error, "FindAllAccountsAsync failed with {}", accountsStatus);
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "FindAllAccountsAsync failed with {}", accountsStatus);
         PrintProviderError(findResults.ProviderError());
     }
 
@@ -178,16 +537,94 @@ IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
         co_return EXIT_SUCCESS;
     }
 
+    if (option.RequestFile())
+    {
+        co_return co_await RunRequestFileAsync(session, option, anchor);
+    }
+
+    if (option.AllAccounts())
+    {
+        co_return co_await RunAllAccountsAsync(session, option);
+    }
+
+    if (option.Iterations())
+    {
+        co_return co_await RunLoadTestAsync(session, option);
+    }
+
+    if (option.ScopeSets().size() > 1)
+    {
+        co_return co_await RunBatchAsync(session, option);
+    }
+
     /*
     * Request a token
     */
+    const auto mode = option.Mode().value_or(RequestMode::Both);
+    auto exitCode = EXIT_SUCCESS;
+
+    if (mode == RequestMode::Parallel)
+    {
+        // Start both before awaiting either, so the UI is up while the silent request is still running
+        auto silent = RequestTokenSilentlyAsync(session, option, provider);
+        auto interactive = RequestTokenInteractivelyAsync(session, option, provider, anchor);
+
+        const auto silentExitCode = co_await silent;
+        const auto interactiveExitCode = co_await interactive;
+        co_return silentExitCode == EXIT_SUCCESS ? interactiveExitCode : silentExitCode;
+    }
+
+    if (mode == RequestMode::Silent || mode == RequestMode::Both)
+    {
+        exitCode = co_await RequestTokenSilentlyAsync(session, option, provider);
+    }
+
+    if (mode == RequestMode::Both && not jsonLines)
+    {
+        Console::WriteLine("");
+    }
+
+    // In Both mode the interactive request is the fallback of the silent one, so its result is the result of the run
+    if (mode == RequestMode::Interactive || mode == RequestMode::Both)
+    {
+        exitCode = co_await RequestTokenInteractivelyAsync(session, option, provider, anchor);
+    }
+
+    co_return exitCode;
+}
+
+/// <summary>
+/// GetTokenSilentlyAsync with the options of this run, bound to the found account with --bindaccount
+/// </summary>
+IAsyncOperation<int> RequestTokenSilentlyAsync(WAM::Session& session, const Option& option, const WebAccountProvider provider)
+{
+    const auto jsonLines = option.Output() == OutputFormat::JsonLines;
+    auto exitCode = EXIT_FAILURE;
+
     try
     {
         Logger::WriteLine(ConsoleFormat::Verbose, "Invoking WebAuthenticationCoreManager::GetTokenSilentlyAsync ...");
 
         const auto request = GetWebTokenRequest(provider, WebTokenRequestPromptType::Default, option);
+        const auto clientId = option.ClientId().value_or(WAM::ClientId::MSOFFICE);
+
+        // With --bindaccount, pass the cached WebAccount to measure account-bound silent calls separately
+        const auto account = option.BindAccount() ? WAM::SelectAccount(co_await session.FindAllAccountsAsync(provider, clientId), option.LoginHint()) : WebAccount{ nullptr };
+
+        if (option.BindAccount())
+        {
+            Logger::WriteLine(L"Bound WebAccount: {}", account ? account.UserName() : L"(none found)");
+        }
+
+        auto timer = ScopedTimer{ account ? "GetTokenSilentlyAsync(WebAccount)" : "GetTokenSilentlyAsync" };
+        const auto& requestResult = co_await InvokeGetTokenSilentlyAsync(session.Wam(), request, account, session.RetryPolicy());
+        const auto latency = timer.Stop();
+
+        if (jsonLines)
+        {
+            WriteJsonRecord("GetTokenSilentlyAsync", latency, request, requestResult);
+        }
 
-        const auto& requestResult = co_await WebAuthenticationCoreManager::GetTokenSilentlyAsync(request);
         const auto requestStatus = requestResult.ResponseStatus();
 
         Logger::WriteLine("GetTokenSilentlyAsync's ResponseStatus: {}", requestStatus);
@@ -195,6 +632,7 @@ IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
         if (requestStatus == WebTokenRequestStatus::Success)
         {
             PrintWebTokenResponse(requestResult.ResponseData().GetAt(0));
+            exitCode = EXIT_SUCCESS;
         }
         else
         {
@@ -204,10 +642,24 @@ IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
     catch (const winrt::hresult_error& e)
     {
         // https://learn.microsoft.com/en-us/windows/uwp/cpp-and-winrt-apis/error-handling
-        Logger::WriteLine(ConsoleFormat::Error, L"GetTokenSilentlyAsync failed with an exception. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"GetTokenSilentlyAsync failed with an exception. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+
+        if (jsonLines)
+        {
+            WriteJsonRecord("GetTokenSilentlyAsync", e);
+        }
     }
 
-    Console::WriteLine("");
+    co_return exitCode;
+}
+
+/// <summary>
+/// RequestTokenAsync with ForceAuthentication, which shows UI regardless of the auth state
+/// </summary>
+IAsyncOperation<int> RequestTokenInteractivelyAsync(WAM::Session& session, const Option& option, const WebAccountProvider provider, AnchorWindow& anchor)
+{
+    const auto jsonLines = option.Output() == OutputFormat::JsonLines;
+    auto exitCode = EXIT_FAILURE;
 
     try
     {
@@ -216,20 +668,28 @@ IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
         // Use ForceAuthentication here to show UI regardless of auth state.
         const auto request = GetWebTokenRequest(provider, WebTokenRequestPromptType::ForceAuthentication, option);
 
-        const auto& requestResult = co_await InvokeRequestTokenAsync(request, hwnd);
+        co_await anchor.ResumeOnLoopThread();
+        const auto start = Benchmark::Clock::now();
+        const auto& requestResult = co_await InvokeRequestTokenAsync(session.Wam(), request, anchor.Get(), session.RetryPolicy());
         auto requestStatus = requestResult.ResponseStatus();
 
+        if (jsonLines)
+        {
+            WriteJsonRecord("RequestTokenAsync", Benchmark::Clock::now() - start, request, requestResult);
+        }
+
         Logger::WriteLine("RequestTokenAsync's ResponseStatus: {}", requestStatus);
 
         if (requestStatus == WebTokenRequestStatus::Success)
         {
             PrintWebTokenResponse(requestResult.ResponseData().GetAt(0));
+            exitCode = EXIT_SUCCESS;
         }
         else
         {
             if (requestStatus == WebTokenRequestStatus::UserCancel)
             {
-                Logger::WriteLine(ConsoleFormat::Warning, "User canceled the request");
+                Logger::WriteLine<Level::Warning>(ConsoleFormat::Warning, "User canceled the request");
             }
 
             PrintProviderError(requestResult.ResponseError());
@@ -237,99 +697,1587 @@ IAsyncOperation<int> MainAsync(const Option& option, const HWND hwnd)
     }
     catch (const winrt::hresult_error& e)
     {
-        Logger::WriteLine(ConsoleFormat::Error, L"RequestTokenAsync failed with an exception. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"RequestTokenAsync failed with an exception. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+
+        if (jsonLines)
+        {
+            WriteJsonRecord("RequestTokenAsync", e);
+        }
     }
-}
 
+    co_return exitCode;
+}
 
 WebTokenRequest GetWebTokenRequest(const WebAccountProvider& provider, const WebTokenRequestPromptType promptType, const Option& option)
 {
-    // If scopes & client IDs are provided, use them.
-    const auto clientId = option.ClientId().value_or(WAM::ClientId::MSOFFICE);
-    const auto scopes = option.Scopes().value_or(WAM::Scopes::DEFAULT_SCOPES);
-    
+    // If scopes are provided, use them.
+    return GetWebTokenRequest(provider, promptType, option, option.Scopes().value_or(WAM::Scopes::DEFAULT_SCOPES));
+}
+
+WebTokenRequest GetWebTokenRequest(const WebAccountProvider& provider, const WebTokenRequestPromptType promptType, const Option& option, const winrt::hstring& scopes)
+{
+    // If a client ID is provided, use it.
+    return GetWebTokenRequest(provider, promptType, option.ClientId().value_or(WAM::ClientId::MSOFFICE), scopes, option.Properties());
+}
+
+WebTokenRequest GetWebTokenRequest(
+    const WebAccountProvider& provider,
+    const WebTokenRequestPromptType promptType,
+    const winrt::hstring& clientId,
+    const winrt::hstring& scopes,
+    const std::unordered_map<winrt::hstring, winrt::hstring>& properties)
+{
     auto request = WebTokenRequest{ provider, scopes, clientId, promptType };
 
     // Add request properties
-    for (const auto& [key, value] : option.Properties())
+    for (const auto& [key, value] : properties)
     {
         request.Properties().Insert(key, value);
     }
 
+    // The key of the request's spans, so every request gets one
+    if (request.CorrelationId().empty())
+    {
+        request.CorrelationId(Spans::NewCorrelationId());
+    }
+
     // Log request properties
-    Trace::Write("WebTokenRequest:");
-    Trace::Write(L"  clientId: {}", request.ClientId());
-    Trace::Write(L"  Scope: '{}'", request.Scope());
-    Trace::Write("  PromptType: {}", request.PromptType());
-    Trace::Write(L"  CorrelationId: {}", request.CorrelationId());
+    Trace::Write<Level::Verbose>("WebTokenRequest:");
+    Trace::Write<Level::Verbose>(L"  clientId: {}", request.ClientId());
+    Trace::Write<Level::Verbose>(L"  Scope: '{}'", request.Scope());
+    Trace::Write<Level::Verbose>("  PromptType: {}", request.PromptType());
+    Trace::Write<Level::Verbose>(L"  CorrelationId: {}", request.CorrelationId());
 
     for (auto&& [key, val] : request.Properties())
     {
-        Trace::Write(L"  Property: {}={}", key, val);
+        Trace::Write<Level::Verbose>(L"  Property: {}={}", key, val);
     }
 
     return request;
 }
 
-IAsyncOperation<WebTokenRequestResult> InvokeRequestTokenAsync(const WebTokenRequest& request, const HWND hwnd)
+/// <summary>
+/// GetTokenSilentlyAsync, bound to the account if given, under the retry policy. Recorded as a span of the request's CorrelationId.
+/// </summary>
+IAsyncOperation<WebTokenRequestResult> InvokeGetTokenSilentlyAsync(WAM::IWamClient& wam, const WebTokenRequest& request, const WebAccount& account, const Retry::Policy& policy)
 {
-    // Invoke RequestTokenAsync() via IWebAuthenticationCoreManagerInterop::RequestTokenForWindowAsync()
-    // https://devblogs.microsoft.com/oldnewthing/20210805-00/?p=105520
-    auto interop = winrt::get_activation_factory<WebAuthenticationCoreManager, IWebAuthenticationCoreManagerInterop>();
-    auto requestInspectable = static_cast<::IInspectable*>(winrt::get_abi(request));
+    auto span = Spans::ScopedSpan{ "GetTokenSilentlyAsync", request.CorrelationId() };
 
-    auto getTokenTask = winrt::capture<IAsyncOperation<WebTokenRequestResult>>(
-        interop,
-        &IWebAuthenticationCoreManagerInterop::RequestTokenForWindowAsync,
-        hwnd,
-        requestInspectable);
+    try
+    {
+        const auto result = co_await Retry::RunAsync<WebTokenRequestResult>(policy, "GetTokenSilentlyAsync", [&wam, request, account] {
+            return wam.GetTokenSilentlyAsync(request, account);
+        });
 
-    co_return co_await getTokenTask;
+        SetSpanResult(span, result);
+        co_return result;
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        span.SetResult("Exception", static_cast<std::uint32_t>(e.code()));
+        throw;
+    }
+    catch (...)
+    {
+        span.SetResult("Exception", static_cast<std::uint32_t>(E_FAIL));
+        throw;
+    }
 }
 
-void PrintWebTokenResponse(const WebTokenResponse& response) noexcept
+IAsyncOperation<WebTokenRequestResult> InvokeRequestTokenAsync(WAM::IWamClient& wam, const WebTokenRequest& request, const HWND hwnd, const Retry::Policy& policy)
 {
-    Logger::WriteLine(L"  WebAccount Id:{}", response.WebAccount().Id());
-    Logger::WriteLine("  WebTokenResponse Properties:\n");
+    // A UI that timed out or failed is not shown again: the timeout applies, the retries do not
+    auto interactivePolicy = policy;
+    interactivePolicy.Retries = 0;
+
+    auto timer = ScopedTimer{ "RequestTokenForWindowAsync" };
+    auto span = Spans::ScopedSpan{ "RequestTokenForWindowAsync", request.CorrelationId() };
 
-    for (const auto& [key, value] : response.Properties())
+    try
     {
-        Logger::WriteLine(L"  [{},{}]", key, value);
-    }
+        const auto result = co_await Retry::RunAsync<WebTokenRequestResult>(interactivePolicy, "RequestTokenForWindowAsync", [&] {
+            return wam.RequestTokenForWindowAsync(hwnd, request);
+        });
 
-    // Print response's error if any
-    PrintProviderError(response.ProviderError());
+        SetSpanResult(span, result);
+        co_return result;
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        span.SetResult("Exception", static_cast<std::uint32_t>(e.code()));
+        throw;
+    }
+    catch (...)
+    {
+        span.SetResult("Exception", static_cast<std::uint32_t>(E_FAIL));
+        throw;
+    }
 }
 
-void PrintProviderError(const WebProviderError& error) noexcept
+/// <summary>
+/// The response status, and the provider's error code if any, as the outcome of the span
+/// </summary>
+void SetSpanResult(Spans::ScopedSpan& span, const WebTokenRequestResult& result) noexcept
 {
-    // ResponseError might be null (e.g. when status is WebTokenRequestStatus::UserCancel)
-    if (error)
+    try
+    {
+        const auto error = result.ResponseError();
+        span.SetResult(to_string(result.ResponseStatus()), error ? static_cast<std::uint32_t>(error.ErrorCode()) : 0u);
+    }
+    catch (...)
     {
-        Logger::WriteLine(ConsoleFormat::Error, L"ErrorCode: {:#x}; ErrorMessage: {}", static_cast<std::uint32_t>(error.ErrorCode()), error.ErrorMessage());
     }
 }
 
-LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+/// <summary>
+/// The policy from --timeout & --retries. With --output jsonl, every attempt is also written as a record.
+/// </summary>
+Retry::Policy GetRetryPolicy(const Option& option)
 {
-    switch (msg)
-    {
-    case WM_DESTROY:
-        PostQuitMessage(0);
-        return 0;
+    auto policy = option.RetryPolicy();
 
-    default:
-        return DefWindowProc(hwnd, msg, wParam, lParam);
+    if (policy.IsActive() && option.Output() == OutputFormat::JsonLines)
+    {
+        policy.OnAttempt = [](const Retry::Attempt& attempt) { WriteJsonRecord(attempt); };
     }
+
+    return policy;
 }
 
-HWND CreateAnchorWindow()
+/// <summary>
+/// The broker, or with --synthetic a stand-in that needs no tenant (ParseOption has validated its config)
+/// </summary>
+std::shared_ptr<WAM::IWamClient> GetWamClient(const Option& option)
 {
-    WNDCLASSEX wndclass{
-    .cbSize = sizeof(WNDCLASSEX),
-    .style = CS_HREDRAW | CS_VREDRAW,
-    .lpfnWndProc = WndProc,
-    .cbClsExtra = 0,
+    if (const auto synthetic = option.Synthetic())
+    {
+        Trace::Write<Level::Warning>("Using a synthetic WAM client: {}", *synthetic);
+        return std::make_shared<WAM::SyntheticWamClient>(WAM::ParseSyntheticConfig(*synthetic).value());
+    }
+
+    return std::make_shared<WAM::WamClient>();
+}
+
+/// <summary>
+/// Run GetTokenSilentlyAsync the given number of times, keeping up to "concurrency" calls in flight, and report throughput & latency
+/// </summary>
+IAsyncOperation<int> RunLoadTestAsync(WAM::Session& session, const Option& option)
+{
+    const auto iterations = option.Iterations().value();
+    const auto concurrency = std::min(option.Concurrency(), iterations);
+
+    Logger::WriteLine(ConsoleFormat::Verbose, "Starting a load test of GetTokenSilentlyAsync. Iterations:{}; Concurrency:{}", iterations, concurrency);
+
+    auto loadTest = Benchmark::LoadTest{ iterations, option.CacheThreshold() };
+    auto workers = std::vector<IAsyncAction>{};
+    workers.reserve(concurrency);
+
+    const auto start = Benchmark::Clock::now();
+
+    // Each worker keeps one request in flight until all iterations are handed out.
+    for (int i = 0; i < concurrency; ++i)
+    {
+        workers.push_back(LoadTestWorkerAsync(session, option, loadTest));
+    }
+
+    for (const auto& worker : workers)
+    {
+        co_await worker;
+    }
+
+    const auto elapsed = Benchmark::Milliseconds{ Benchmark::Clock::now() - start };
+    const auto summary = loadTest.GetSummary();
+    const auto throughput = elapsed.count() > 0 ? summary.Count / (elapsed.count() / 1000) : 0.0;
+
+    auto block = Console::Block{};
+
+    Logger::WriteLine("");
+    Logger::WriteLine("Load test results:");
+    Logger::WriteLine("  Iterations: {} (Succeeded:{}; Failed:{})", loadTest.Iterations(), loadTest.Succeeded(), loadTest.Failed());
+    Logger::WriteLine("  Concurrency: {}", concurrency);
+    Logger::WriteLine("  Elapsed: {:.3f} ms", elapsed.count());
+    Logger::WriteLine("  Throughput: {:.2f} requests/sec", throughput);
+    Logger::WriteLine("  Latency (ms): min:{:.3f}; mean:{:.3f}; p50:{:.3f}; p90:{:.3f}; p99:{:.3f}; max:{:.3f}",
+        summary.Min.count(), summary.Mean.count(), summary.P50.count(), summary.P90.count(), summary.P99.count(), summary.Max.count());
+
+    // Successful requests, split by where the token probably came from
+    const auto cacheSummary = loadTest.GetSummary(Benchmark::PathClass::Cache);
+    const auto networkSummary = loadTest.GetSummary(Benchmark::PathClass::Network);
+
+    for (const auto& [name, classSummary] : { std::pair{ "Cache-served", cacheSummary }, std::pair{ "Network-served", networkSummary } })
+    {
+        Logger::WriteLine("  {} (probable): {} ({:.1f}%)", name, classSummary.Count, summary.Count > 0 ? 100.0 * classSummary.Count / summary.Count : 0.0);
+
+        if (classSummary.Count > 0)
+        {
+            Logger::WriteLine("    Latency (ms): min:{:.3f}; mean:{:.3f}; p50:{:.3f}; p90:{:.3f}; p99:{:.3f}; max:{:.3f}",
+                classSummary.Min.count(), classSummary.Mean.count(), classSummary.P50.count(), classSummary.P90.count(), classSummary.P99.count(), classSummary.Max.count());
+        }
+    }
+
+    if (option.Output() == OutputFormat::JsonLines)
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", "LoadTest")
+                .Field("iterations", loadTest.Iterations())
+                .Field("succeeded", loadTest.Succeeded())
+                .Field("failed", loadTest.Failed())
+                .Field("concurrency", concurrency)
+                .Field("durationMs", elapsed.count())
+                .Field("throughput", throughput)
+                .Field("minMs", summary.Min.count())
+                .Field("meanMs", summary.Mean.count())
+                .Field("p50Ms", summary.P50.count())
+                .Field("p90Ms", summary.P90.count())
+                .Field("p99Ms", summary.P99.count())
+                .Field("maxMs", summary.Max.count());
+
+            for (const auto& [name, classSummary] : { std::pair{ "cache", cacheSummary }, std::pair{ "network", networkSummary } })
+            {
+                json.Key(name).BeginObject()
+                    .Field("count", classSummary.Count)
+                    .Field("p50Ms", classSummary.P50.count())
+                    .Field("p90Ms", classSummary.P90.count())
+                    .Field("p99Ms", classSummary.P99.count())
+                    .Field("maxMs", classSummary.Max.count())
+                    .EndObject();
+            }
+        });
+    }
+
+    co_return loadTest.Failed() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+IAsyncAction LoadTestWorkerAsync(WAM::Session& session, const Option& option, Benchmark::LoadTest& loadTest)
+{
+    const auto clientId = option.ClientId().value_or(WAM::ClientId::MSOFFICE);
+    auto iteration = 0;
+
+    while (loadTest.TryAcquire(iteration))
+    {
+        // --refreshaccounts makes every iteration pay for the provider & account lookups
+        if (option.RefreshAccounts())
+        {
+            session.Invalidate();
+        }
+
+        auto provider = WebAccountProvider{ nullptr };
+        auto account = WebAccount{ nullptr };
+
+        try
+        {
+            provider = co_await session.GetProviderAsync();
+
+            if (provider && (option.BindAccount() || option.RefreshAccounts()))
+            {
+                const auto findResults = co_await session.FindAllAccountsAsync(provider, clientId);
+
+                if (option.BindAccount())
+                {
+                    account = WAM::SelectAccount(findResults, option.LoginHint());
+                }
+            }
+        }
+        catch (const winrt::hresult_error& e)
+        {
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"Iteration {}: Provider or account lookup failed with an exception. code:{:#x}; message:{}", iteration, static_cast<std::uint32_t>(e.code()), e.message());
+        }
+
+        if (not provider)
+        {
+            loadTest.RecordFailure();
+            continue;
+        }
+
+        const auto request = GetWebTokenRequest(provider, WebTokenRequestPromptType::Default, option);
+        auto timer = ScopedTimer{ account ? "GetTokenSilentlyAsync(WebAccount)" : "GetTokenSilentlyAsync" };
+
+        try
+        {
+            const auto& requestResult = co_await InvokeGetTokenSilentlyAsync(session.Wam(), request, account, session.RetryPolicy());
+            const auto latency = timer.Stop();
+            const auto requestStatus = requestResult.ResponseStatus();
+
+            if (requestStatus != WebTokenRequestStatus::Success)
+            {
+                loadTest.Record(latency, false);
+                Trace::Write<Level::Verbose>("Iteration {}: GetTokenSilentlyAsync's ResponseStatus: {}; Latency: {:.3f} ms", iteration, requestStatus, Benchmark::Milliseconds{ latency }.count());
+                PrintProviderError(requestResult.ResponseError());
+                continue;
+            }
+
+            // The token's iat next to the latency tells a broker cache hit (same token as before) from a network round trip (new token)
+            const auto claims = Jwt::DecodeClaims(requestResult.ResponseData().GetAt(0).Token());
+            const auto issuedAt = claims ? claims->IssuedAt : std::nullopt;
+            const auto pathClass = loadTest.Record(latency, issuedAt);
+
+            Trace::Write<Level::Verbose>("Iteration {}: GetTokenSilentlyAsync's ResponseStatus: {}; Latency: {:.3f} ms; iat: {}; Probably served from: {}",
+                iteration, requestStatus, Benchmark::Milliseconds{ latency }.count(), issuedAt.value_or(-1), pathClass == Benchmark::PathClass::Cache ? "cache" : "network");
+        }
+        catch (const winrt::hresult_error& e)
+        {
+            loadTest.Record(timer.Stop(), false);
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"Iteration {}: GetTokenSilentlyAsync failed with an exception. code:{:#x}; message:{}", iteration, static_cast<std::uint32_t>(e.code()), e.message());
+        }
+    }
+}
+
+/// <summary>
+/// Issue a silent request for every --scopes value at once and report the results per scope set.
+/// Comparing the wall time with the sum of the latencies shows whether the broker serves the requests in parallel.
+/// </summary>
+IAsyncOperation<int> RunBatchAsync(WAM::Session& session, const Option& option)
+{
+    const auto& scopeSets = option.ScopeSets();
+    const auto provider = co_await session.GetProviderAsync();
+    const auto clientId = option.ClientId().value_or(WAM::ClientId::MSOFFICE);
+    const auto account = option.BindAccount() ? WAM::SelectAccount(co_await session.FindAllAccountsAsync(provider, clientId), option.LoginHint()) : WebAccount{ nullptr };
+
+    Logger::WriteLine(ConsoleFormat::Verbose, "Invoking WebAuthenticationCoreManager::GetTokenSilentlyAsync for {} scope sets concurrently ...", scopeSets.size());
+
+    // Each request writes only its own slot, so the results need no locking
+    auto results = std::vector<BatchResult>(scopeSets.size());
+    auto requests = std::vector<IAsyncAction>{};
+    requests.reserve(scopeSets.size());
+
+    auto wallTimer = ScopedTimer{ "Batch" };
+
+    for (std::size_t i = 0; i < scopeSets.size(); ++i)
+    {
+        results[i].Scopes = scopeSets[i];
+        results[i].Request = GetWebTokenRequest(provider, WebTokenRequestPromptType::Default, option, scopeSets[i]);
+        requests.push_back(BatchRequestAsync(session.Wam(), results[i].Request, account, session.RetryPolicy(), results[i]));
+    }
+
+    for (const auto& request : requests)
+    {
+        co_await request;
+    }
+
+    const auto wall = Benchmark::Milliseconds{ wallTimer.Stop() };
+    auto sum = Benchmark::Milliseconds{};
+    auto failed = 0;
+
+    const auto jsonLines = option.Output() == OutputFormat::JsonLines;
+
+    for (const auto& result : results)
+    {
+        sum += result.Latency;
+
+        if (jsonLines)
+        {
+            if (result.Error)
+            {
+                WriteJsonRecord("GetTokenSilentlyAsync", *result.Error);
+            }
+            else
+            {
+                WriteJsonRecord("GetTokenSilentlyAsync", result.Latency, result.Request, result.Result);
+            }
+        }
+
+        Logger::WriteLine("");
+        Logger::WriteLine(L"Scopes: '{}'", result.Scopes);
+
+        if (result.Error)
+        {
+            ++failed;
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"GetTokenSilentlyAsync failed with an exception. code:{:#x}; message:{}", static_cast<std::uint32_t>(result.Error->code()), result.Error->message());
+            continue;
+        }
+
+        const auto requestStatus = result.Result.ResponseStatus();
+
+        Logger::WriteLine("GetTokenSilentlyAsync's ResponseStatus: {}; Latency: {:.3f} ms", requestStatus, Benchmark::Milliseconds{ result.Latency }.count());
+
+        if (requestStatus == WebTokenRequestStatus::Success)
+        {
+            PrintWebTokenResponse(result.Result.ResponseData().GetAt(0));
+        }
+        else
+        {
+            ++failed;
+            PrintProviderError(result.Result.ResponseError());
+        }
+    }
+
+    auto block = Console::Block{};
+
+    // Close to 1x means the requests were effectively served one after another
+    Logger::WriteLine("");
+    Logger::WriteLine("Batch results:");
+    Logger::WriteLine("  Requests: {} (Succeeded:{}; Failed:{})", results.size(), results.size() - failed, failed);
+    Logger::WriteLine("  Wall time: {:.3f} ms", wall.count());
+    Logger::WriteLine("  Sum of latencies: {:.3f} ms", sum.count());
+    Logger::WriteLine("  Overlap: {:.2f}x", wall.count() > 0 ? sum.count() / wall.count() : 0.0);
+
+    if (jsonLines)
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", "Batch")
+                .Field("requests", results.size())
+                .Field("failed", failed)
+                .Field("durationMs", wall.count())
+                .Field("sumOfLatencyMs", sum.count());
+        });
+    }
+
+    co_return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+IAsyncAction BatchRequestAsync(WAM::IWamClient& wam, const WebTokenRequest request, const WebAccount account, const Retry::Policy& policy, BatchResult& result)
+{
+    auto timer = ScopedTimer{ account ? "GetTokenSilentlyAsync(WebAccount)" : "GetTokenSilentlyAsync" };
+
+    try
+    {
+        result.Result = co_await InvokeGetTokenSilentlyAsync(wam, request, account, policy);
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        result.Error = e;
+    }
+
+    result.Latency = timer.Stop();
+}
+
+/// <summary>
+/// Run the request lines of --requestfile (or of standard input) through a bounded pipeline of --concurrency workers.
+/// Each worker reads a line, builds & issues its request, and reports the result before it reads the next one, so at most
+/// --concurrency lines are held at a time and memory stays flat however long the input is.
+/// </summary>
+IAsyncOperation<int> RunRequestFileAsync(WAM::Session& session, const Option& option, AnchorWindow& anchor)
+{
+    const auto path = *option.RequestFile();
+    const auto concurrency = option.Concurrency();
+    auto run = std::optional<RequestFileRun>{};
+
+    try
+    {
+        run.emplace(path);
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"Failed to open the request file {}. code:{:#x}; message:{}", path.wstring(), static_cast<std::uint32_t>(e.code()), e.message());
+        co_return EXIT_FAILURE;
+    }
+
+    if (not co_await session.GetProviderAsync())
+    {
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "Failed to find a WebAccountProvider");
+        co_return EXIT_FAILURE;
+    }
+
+    Logger::WriteLine(ConsoleFormat::Verbose, L"Running the requests of {}. Concurrency:{}", path == L"-" ? L"standard input" : path.wstring(), concurrency);
+
+    auto workers = std::vector<IAsyncAction>{};
+    workers.reserve(concurrency);
+
+    auto wallTimer = ScopedTimer{ "RequestFile" };
+
+    for (int i = 0; i < concurrency; ++i)
+    {
+        workers.push_back(RequestFileWorkerAsync(session, option, anchor, *run));
+    }
+
+    for (const auto& worker : workers)
+    {
+        co_await worker;
+    }
+
+    const auto elapsed = Benchmark::Milliseconds{ wallTimer.Stop() };
+    const auto summary = run->Latency.GetSummary();
+    const auto succeeded = run->Succeeded.load();
+    const auto failed = run->Failed.load();
+    const auto throughput = elapsed.count() > 0 ? summary.Count / (elapsed.count() / 1000) : 0.0;
+
+    auto block = Console::Block{};
+
+    Logger::WriteLine("");
+    Logger::WriteLine("Request file results:");
+    Logger::WriteLine("  Requests: {} (Succeeded:{}; Failed:{})", succeeded + failed, succeeded, failed);
+    Logger::WriteLine("  Concurrency: {}", concurrency);
+    Logger::WriteLine("  Elapsed: {:.3f} ms", elapsed.count());
+    Logger::WriteLine("  Throughput: {:.2f} requests/sec", throughput);
+    Logger::WriteLine("  Latency (ms): min:{:.3f}; mean:{:.3f}; p50:{:.3f}; p90:{:.3f}; p99:{:.3f}; max:{:.3f}",
+        summary.Min.count(), summary.Mean.count(), summary.P50.count(), summary.P90.count(), summary.P99.count(), summary.Max.count());
+
+    if (option.Output() == OutputFormat::JsonLines)
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", "RequestFile")
+                .Field("requests", succeeded + failed)
+                .Field("succeeded", succeeded)
+                .Field("failed", failed)
+                .Field("complete", not run->Stopped.load())
+                .Field("concurrency", concurrency)
+                .Field("durationMs", elapsed.count())
+                .Field("throughput", throughput)
+                .Field("p50Ms", summary.P50.count())
+                .Field("p90Ms", summary.P90.count())
+                .Field("p99Ms", summary.P99.count())
+                .Field("maxMs", summary.Max.count());
+        });
+    }
+
+    co_return failed == 0 && not run->Stopped ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+IAsyncAction RequestFileWorkerAsync(WAM::Session& session, const Option& option, AnchorWindow& anchor, RequestFileRun& run)
+{
+    // Reading the input blocks, so stay off the UI thread
+    co_await winrt::resume_background();
+
+    const auto jsonLines = option.Output() == OutputFormat::JsonLines;
+
+    // Reused for every line this worker reads
+    auto line = std::string{};
+    auto number = std::size_t{};
+
+    while (true)
+    {
+        try
+        {
+            auto lock = std::scoped_lock{ run.ReaderMutex };
+
+            if (run.Stopped || not run.Reader.ReadLine(line, number))
+            {
+                break;
+            }
+        }
+        catch (const winrt::hresult_error& e)
+        {
+            run.Stopped = true;
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"Failed to read the request file. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+            break;
+        }
+
+        auto spec = WAM::ParseRequestSpec(line);
+
+        if (not spec)
+        {
+            ++run.Failed;
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "Line {}: {}", number, spec.error());
+            continue;
+        }
+
+        // --property values apply to every line unless the line sets the same key
+        for (const auto& [key, value] : option.Properties())
+        {
+            spec->Properties.try_emplace(key, value);
+        }
+
+        const auto phase = spec->Interactive ? "RequestTokenAsync" : "GetTokenSilentlyAsync";
+
+        try
+        {
+            const auto provider = co_await session.GetProviderAsync();
+            const auto clientId = spec->ClientId.value_or(option.ClientId().value_or(WAM::ClientId::MSOFFICE));
+            const auto scopes = spec->Scopes.value_or(option.Scopes().value_or(WAM::Scopes::DEFAULT_SCOPES));
+            const auto promptType = spec->Interactive ? WebTokenRequestPromptType::ForceAuthentication : WebTokenRequestPromptType::Default;
+
+            const auto request = GetWebTokenRequest(provider, promptType, clientId, scopes, spec->Properties);
+            const auto account = option.BindAccount() && not spec->Interactive
+                ? WAM::SelectAccount(co_await session.FindAllAccountsAsync(provider, clientId), spec->LoginHint())
+                : WebAccount{ nullptr };
+
+            // The interactive call is made on the thread that owns the window, and the worker goes back to the thread pool after it
+            if (spec->Interactive)
+            {
+                co_await anchor.ResumeOnLoopThread();
+            }
+
+            auto timer = ScopedTimer{ phase };
+            const auto requestResult = spec->Interactive
+                ? co_await InvokeRequestTokenAsync(session.Wam(), request, anchor.Get(), session.RetryPolicy())
+                : co_await InvokeGetTokenSilentlyAsync(session.Wam(), request, account, session.RetryPolicy());
+            const auto latency = timer.Stop();
+
+            if (spec->Interactive)
+            {
+                co_await winrt::resume_background();
+            }
+            const auto requestStatus = requestResult.ResponseStatus();
+
+            run.Latency.Add(latency);
+            (requestStatus == WebTokenRequestStatus::Success ? run.Succeeded : run.Failed).fetch_add(1);
+
+            if (jsonLines)
+            {
+                WriteJsonRecord(phase, latency, request, requestResult);
+            }
+
+            Logger::WriteLine("Line {}: scopes:'{}'; ResponseStatus: {}; Latency: {:.3f} ms", number, Util::to_string(scopes), requestStatus, Benchmark::Milliseconds{ latency }.count());
+
+            if (requestStatus != WebTokenRequestStatus::Success)
+            {
+                PrintProviderError(requestResult.ResponseError());
+            }
+        }
+        catch (const winrt::hresult_error& e)
+        {
+            ++run.Failed;
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"Line {}: request failed with an exception. code:{:#x}; message:{}", number, static_cast<std::uint32_t>(e.code()), e.message());
+
+            if (jsonLines)
+            {
+                WriteJsonRecord(phase, e);
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Request a token silently for every found account (whose UserName contains --accountfilter if given), with up to
+/// --concurrency requests in flight, and print a latency & status table per account.
+/// Raising --concurrency until the latencies grow faster than the overlap shows where the broker starts throttling.
+/// </summary>
+IAsyncOperation<int> RunAllAccountsAsync(WAM::Session& session, const Option& option)
+{
+    const auto provider = co_await session.GetProviderAsync();
+    const auto clientId = option.ClientId().value_or(WAM::ClientId::MSOFFICE);
+    const auto findResults = co_await session.FindAllAccountsAsync(provider, clientId);
+
+    if (findResults.Status() != FindAllWebAccountsStatus::Success)
+    {
+        co_return EXIT_FAILURE;
+    }
+
+    const auto& filter = option.AccountFilter();
+    auto results = std::vector<AccountResult>{};
+
+    for (const auto& account : findResults.Accounts())
+    {
+        if (filter && ::FindStringOrdinal(FIND_FROMSTART, account.UserName().c_str(), -1, filter->c_str(), -1, TRUE) < 0)
+        {
+            continue;
+        }
+
+        auto& result = results.emplace_back();
+        result.Account = account;
+        result.Request = GetWebTokenRequest(provider, WebTokenRequestPromptType::Default, option);
+    }
+
+    if (results.empty())
+    {
+        Logger::WriteLine<Level::Warning>(ConsoleFormat::Warning, "No accounts to request tokens for");
+        co_return EXIT_FAILURE;
+    }
+
+    const auto concurrency = std::min<std::size_t>(option.Concurrency(), results.size());
+
+    Logger::WriteLine(ConsoleFormat::Verbose, "Invoking WebAuthenticationCoreManager::GetTokenSilentlyAsync for {} account(s). Concurrency:{} ...", results.size(), concurrency);
+
+    // Each request writes only its own slot, so the results need no locking
+    auto wallTimer = ScopedTimer{ "AllAccounts" };
+    co_await Scheduler::ForEachAsync(results.size(), concurrency, [&](std::size_t i) { return AccountRequestAsync(session, results[i]); });
+
+    const auto wall = Benchmark::Milliseconds{ wallTimer.Stop() };
+    const auto jsonLines = option.Output() == OutputFormat::JsonLines;
+    auto latency = Benchmark::Histogram{};
+    auto sum = Benchmark::Milliseconds{};
+    auto failed = 0;
+    auto nameWidth = std::size_t{ 8 };
+
+    for (const auto& result : results)
+    {
+        nameWidth = std::max(nameWidth, static_cast<std::size_t>(result.Account.UserName().size()));
+    }
+
+    auto block = Console::Block{};
+
+    Logger::WriteLine("");
+    Logger::WriteLine("Results per account:");
+    Logger::WriteLine("  {:<{}}  {:<24}  {:>12}", "UserName", nameWidth, "ResponseStatus", "Latency (ms)");
+
+    for (const auto& result : results)
+    {
+        const auto userName = Util::to_string(result.Account.UserName());
+        const auto ms = Benchmark::Milliseconds{ result.Latency }.count();
+
+        latency.Add(result.Latency);
+        sum += result.Latency;
+
+        if (result.Error)
+        {
+            ++failed;
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "  {:<{}}  {:<24}  {:>12.3f}  code:{:#x}", userName, nameWidth, "Exception", ms, static_cast<std::uint32_t>(result.Error->code()));
+        }
+        else if (const auto requestStatus = result.Result.ResponseStatus(); requestStatus == WebTokenRequestStatus::Success)
+        {
+            Logger::WriteLine("  {:<{}}  {:<24}  {:>12.3f}", userName, nameWidth, requestStatus, ms);
+        }
+        else
+        {
+            ++failed;
+            const auto error = result.Result.ResponseError();
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "  {:<{}}  {:<24}  {:>12.3f}  code:{:#x}", userName, nameWidth, requestStatus, ms, error ? static_cast<std::uint32_t>(error.ErrorCode()) : 0u);
+        }
+
+        if (jsonLines)
+        {
+            if (result.Error)
+            {
+                WriteJsonRecord("GetTokenSilentlyAsync(WebAccount)", *result.Error);
+            }
+            else
+            {
+                WriteJsonRecord("GetTokenSilentlyAsync(WebAccount)", result.Latency, result.Request, result.Result);
+            }
+        }
+    }
+
+    const auto summary = latency.GetSummary();
+
+    // Close to 1x means the broker served the requests one after another
+    Logger::WriteLine("");
+    Logger::WriteLine("  Accounts: {} (Succeeded:{}; Failed:{}); Concurrency: {}", results.size(), results.size() - failed, failed, concurrency);
+    Logger::WriteLine("  Wall time: {:.3f} ms; Sum of latencies: {:.3f} ms; Overlap: {:.2f}x", wall.count(), sum.count(), wall.count() > 0 ? sum.count() / wall.count() : 0.0);
+    Logger::WriteLine("  Latency (ms): min:{:.3f}; mean:{:.3f}; p50:{:.3f}; p90:{:.3f}; p99:{:.3f}; max:{:.3f}",
+        summary.Min.count(), summary.Mean.count(), summary.P50.count(), summary.P90.count(), summary.P99.count(), summary.Max.count());
+
+    if (jsonLines)
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", "AllAccounts")
+                .Field("accounts", results.size())
+                .Field("failed", failed)
+                .Field("concurrency", concurrency)
+                .Field("durationMs", wall.count())
+                .Field("sumOfLatencyMs", sum.count())
+                .Field("p50Ms", summary.P50.count())
+                .Field("p90Ms", summary.P90.count())
+                .Field("p99Ms", summary.P99.count())
+                .Field("maxMs", summary.Max.count());
+        });
+    }
+
+    co_return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+IAsyncAction AccountRequestAsync(WAM::Session& session, AccountResult& result)
+{
+    auto timer = ScopedTimer{ "GetTokenSilentlyAsync(WebAccount)" };
+
+    try
+    {
+        result.Result = co_await InvokeGetTokenSilentlyAsync(session.Wam(), result.Request, result.Account, session.RetryPolicy());
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        result.Error = e;
+    }
+
+    result.Latency = timer.Stop();
+}
+
+/// <summary>
+/// Run the fixed --bench scenarios, compare them with the --baseline file, and save the results as the baseline with
+/// --savebaseline (or when there is no baseline yet).
+/// The WAM scenarios call the broker (or --synthetic) directly, without the session cache or retries, so every sample pays for the full call.
+/// </summary>
+/// <returns>EXIT_FAILURE if a scenario regressed beyond its threshold</returns>
+IAsyncOperation<int> RunBenchAsync(const Option& option)
+{
+    const auto wam = GetWamClient(option);
+    const auto samples = option.Iterations().value_or(Benchmark::DefaultSamples);
+    const auto clientId = option.ClientId().value_or(WAM::ClientId::MSOFFICE);
+
+    // The results are referred to by the comparisons, so they must not move
+    auto results = std::vector<Benchmark::ScenarioResult>{};
+    results.reserve(8);
+
+    const auto scenario = [&results](std::string_view name) -> Benchmark::ScenarioResult& {
+        return results.emplace_back(Benchmark::ScenarioResult{ .Name = std::string{ name } });
+    };
+
+    Logger::WriteLine(ConsoleFormat::Verbose, "Running the benchmark scenarios. Samples:{}", samples);
+
+    auto provider = WebAccountProvider{ nullptr };
+    auto request = WebTokenRequest{ nullptr };
+    const auto silentSample = [&]() -> IAsyncOperation<bool> {
+        const auto requestResult = co_await InvokeGetTokenSilentlyAsync(*wam, request, nullptr, Retry::Policy{});
+        co_return requestResult.ResponseStatus() == WebTokenRequestStatus::Success;
+    };
+
+    // The first token request of the process is cold (broker connection, token cache load), so it must come before any other
+    // broker call. It needs a provider, so the one sample is the provider lookup and the silent request together.
+    co_await Benchmark::MeasureAsync(scenario("FirstTokenRequest(Cold)"), 1, [&]() -> IAsyncOperation<bool> {
+        provider = co_await wam->FindAccountProviderAsync(WAM::ProviderId::MICROSOFT, WAM::Authority::ORGANIZATION);
+
+        if (not provider)
+        {
+            co_return false;
+        }
+
+        request = GetWebTokenRequest(provider, WebTokenRequestPromptType::Default, option);
+        co_return co_await silentSample();
+    });
+
+    if (not provider)
+    {
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "Failed to find a WebAccountProvider");
+        co_return EXIT_FAILURE;
+    }
+
+    co_await Benchmark::MeasureAsync(scenario("FindAccountProviderAsync"), samples, [&]() -> IAsyncOperation<bool> {
+        const auto found = co_await wam->FindAccountProviderAsync(WAM::ProviderId::MICROSOFT, WAM::Authority::ORGANIZATION);
+        co_return static_cast<bool>(found);
+    });
+
+    co_await Benchmark::MeasureAsync(scenario("FindAllAccountsAsync"), samples, [&]() -> IAsyncOperation<bool> {
+        const auto findResults = co_await wam->FindAllAccountsAsync(provider, clientId);
+        co_return findResults.Status() == FindAllWebAccountsStatus::Success;
+    });
+
+    co_await Benchmark::MeasureAsync(scenario("GetTokenSilentlyAsync(Warm)"), samples, silentSample);
+
+    // Our own per-line overhead, without WAM: one trace message as configured (file, ETW, or none)...
+    Benchmark::MeasureBatches(scenario("TraceWrite"), samples, [](int i) {
+        Trace::Write<Level::Verbose>("Benchmark message {} of a typical length. ResponseStatus: {}; Latency: {:.3f} ms", i, WebTokenRequestStatus::Success, 12.345);
+    });
+
+    // ...and one styled console line, formatted but not written
+    auto line = std::string{};
+    Benchmark::MeasureBatches(scenario("ConsoleFormat"), samples, [&line](int i) {
+        line.clear();
+        Console::detail::AppendStyled(line, ConsoleFormat::Verbose, [i](std::string& out) {
+            Console::detail::FormatTo(out, "Iteration {}: GetTokenSilentlyAsync's ResponseStatus: {}; Latency: {:.3f} ms", i, WebTokenRequestStatus::Success, 12.345);
+        });
+        line.push_back('\n');
+    });
+
+    auto comparisons = std::vector<Benchmark::Comparison>{};
+    const auto& baselinePath = option.BaselinePath();
+    auto baseline = baselinePath ? Benchmark::LoadBaseline(*baselinePath) : std::nullopt;
+
+    if (baseline)
+    {
+        comparisons = Benchmark::Compare(results, *baseline, option.BenchThreshold());
+    }
+
+    PrintBenchResults(option, results, comparisons);
+
+    if (baselinePath && (option.SaveBaseline() || not baseline))
+    {
+        try
+        {
+            Benchmark::SaveBaseline(*baselinePath, results);
+            Logger::WriteLine(ConsoleFormat::Verbose, L"Saved the results as the baseline to {}", baselinePath->wstring());
+        }
+        catch (const std::exception& e)
+        {
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "{}", e.what());
+            co_return EXIT_FAILURE;
+        }
+    }
+
+    const auto regressed = std::ranges::count_if(comparisons, &Benchmark::Comparison::Regressed);
+    co_return regressed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void PrintBenchResults(const Option& option, const std::vector<Benchmark::ScenarioResult>& results, const std::vector<Benchmark::Comparison>& comparisons) noexcept
+{
+    const auto jsonLines = option.Output() == OutputFormat::JsonLines;
+    auto block = Console::Block{};
+
+    Logger::WriteLine("");
+    Logger::WriteLine("Benchmark results (ms):");
+    Logger::WriteLine("  {:<28} {:>6} {:>12} {:>12} {:>12} {:>12}  {}", "Scenario", "Count", "p50", "p90", "p99", "max", comparisons.empty() ? "" : "Change from baseline (p50, p90)");
+
+    for (const auto& result : results)
+    {
+        const auto& summary = result.Summary;
+        const auto it = std::ranges::find(comparisons, &result, &Benchmark::Comparison::Current);
+        const auto comparison = it != comparisons.end() ? &*it : nullptr;
+        auto change = std::string{};
+
+        if (comparison)
+        {
+            std::format_to(std::back_inserter(change), "{:+.1f}%, {:+.1f}% ", comparison->P50Change * 100, comparison->P90Change * 100);
+
+            if (comparison->Gated)
+            {
+                std::format_to(std::back_inserter(change), "(threshold {:.0f}%){}", comparison->ThresholdPercent, comparison->Regressed ? " REGRESSED" : "");
+            }
+            else
+            {
+                change.append("(report only)");
+            }
+        }
+
+        if (result.Failed > 0)
+        {
+            std::format_to(std::back_inserter(change), "{}{} failed", change.empty() ? "" : "; ", result.Failed);
+        }
+
+        const auto& style = comparison && comparison->Regressed ? ConsoleFormat::Error : result.Failed > 0 ? ConsoleFormat::Warning : ConsoleFormat::Default;
+        Logger::WriteLine(style, "  {:<28} {:>6} {:>12.4f} {:>12.4f} {:>12.4f} {:>12.4f}  {}",
+            result.Name, summary.Count, summary.P50.count(), summary.P90.count(), summary.P99.count(), summary.Max.count(), change);
+
+        if (jsonLines)
+        {
+            Json::WriteLine([&](Json::Writer& json) {
+                json.Field("phase", "Bench")
+                    .Field("scenario", result.Name)
+                    .Field("count", summary.Count)
+                    .Field("failed", result.Failed)
+                    .Field("p50Ms", summary.P50.count())
+                    .Field("p90Ms", summary.P90.count())
+                    .Field("p99Ms", summary.P99.count())
+                    .Field("maxMs", summary.Max.count());
+
+                if (comparison)
+                {
+                    json.Field("baselineP50Ms", comparison->Baseline->P50.count())
+                        .Field("baselineP90Ms", comparison->Baseline->P90.count())
+                        .Field("thresholdPct", comparison->ThresholdPercent)
+                        .Field("gated", comparison->Gated)
+                        .Field("regressed", comparison->Regressed);
+                }
+            });
+        }
+    }
+}
+
+/// <summary>
+/// Sign out of all the accounts at once, then report how long each sign-out took.
+/// The wall time next to the sum of the latencies shows how much the sign-outs overlapped.
+/// </summary>
+IAsyncAction SignOutAccountsAsync(WAM::IWamClient& wam, const Collections::IVectorView<WebAccount> accounts, const Option& option)
+{
+    Logger::WriteLine<Level::Warning>(ConsoleFormat::Warning, "Signing out from {} account(s) ...", accounts.Size());
+
+    // Each sign-out writes only its own slot, so the results need no locking
+    auto results = std::vector<SignOutResult>(accounts.Size());
+    auto signOuts = std::vector<IAsyncAction>{};
+    signOuts.reserve(results.size());
+
+    auto wallTimer = ScopedTimer{ "SignOut" };
+
+    for (std::uint32_t i = 0; i < accounts.Size(); ++i)
+    {
+        signOuts.push_back(SignOutAccountAsync(wam, accounts.GetAt(i), results[i]));
+    }
+
+    // All sign-outs are already in flight, so awaiting them in order takes as long as the slowest one
+    for (const auto& signOut : signOuts)
+    {
+        co_await signOut;
+    }
+
+    const auto wall = Benchmark::Milliseconds{ wallTimer.Stop() };
+    auto sum = Benchmark::Milliseconds{};
+
+    for (const auto& result : results)
+    {
+        sum += result.Latency;
+
+        if (result.Error)
+        {
+            Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"  SignOutAsync failed for {} after {:.3f} ms. code:{:#x}; message:{}",
+                result.UserName, Benchmark::Milliseconds{ result.Latency }.count(), static_cast<std::uint32_t>(result.Error->code()), result.Error->message());
+        }
+        else
+        {
+            Logger::WriteLine(L"  Signed out from {} in {:.3f} ms", result.UserName, Benchmark::Milliseconds{ result.Latency }.count());
+        }
+
+        if (option.Output() == OutputFormat::JsonLines)
+        {
+            Json::WriteLine([&](Json::Writer& json) {
+                json.Field("phase", "SignOutAsync")
+                    .Field("status", result.Error ? "Exception" : "Success")
+                    .Field("durationMs", Benchmark::Milliseconds{ result.Latency }.count())
+                    .Field("userName", result.UserName);
+
+                if (result.Error)
+                {
+                    json.Field("errorCode", static_cast<std::uint32_t>(result.Error->code())).Field("errorMessage", result.Error->message());
+                }
+            });
+        }
+    }
+
+    Logger::WriteLine("  Wall time: {:.3f} ms; Sum of latencies: {:.3f} ms", wall.count(), sum.count());
+    Logger::WriteLine("");
+}
+
+IAsyncAction SignOutAccountAsync(WAM::IWamClient& wam, const WebAccount account, SignOutResult& result)
+{
+    result.UserName = account.UserName();
+    auto timer = ScopedTimer{ "SignOutAsync" };
+
+    try
+    {
+        co_await wam.SignOutAsync(account);
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        result.Error = e;
+    }
+
+    result.Latency = timer.Stop();
+}
+
+/// <summary>
+/// Serve token requests over a named pipe until Ctrl+C.
+/// All requests share the cached provider & accounts, and interactive requests reuse the anchor window & message loop of main().
+/// </summary>
+IAsyncOperation<int> ServeAsync(const Option& option, AnchorWindow& anchor)
+{
+    auto session = WAM::Session{ GetRetryPolicy(option), GetWamClient(option) };
+    auto server = Pipe::Server{ Pipe::GetPipePath(option.PipeName()) };
+    auto clients = std::vector<IAsyncAction>{};
+    auto exitCode = EXIT_SUCCESS;
+
+    // Look up the provider now so that the first client does not pay for it
+    if (not co_await session.GetProviderAsync())
+    {
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, "Failed to find a WebAccountProvider");
+        co_return EXIT_FAILURE;
+    }
+
+    Logger::WriteLine(ConsoleFormat::Verbose, L"Serving token requests on {}. Press Ctrl+C to stop", server.Path());
+
+    // Accept() blocks, so leave the UI thread
+    co_await winrt::resume_background();
+
+    try
+    {
+        while (auto pipe = server.Accept())
+        {
+            // Forget the clients that are done
+            std::erase_if(clients, [](const IAsyncAction& client) { return client.Status() != AsyncStatus::Started; });
+            clients.push_back(HandleClientAsync(std::move(pipe), server.StopEvent(), session, option, anchor));
+        }
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"The pipe server failed. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+        exitCode = EXIT_FAILURE;
+    }
+
+    for (const auto& client : clients)
+    {
+        co_await client;
+    }
+
+    Logger::WriteLine(ConsoleFormat::Verbose, "Stopped serving token requests");
+    co_return exitCode;
+}
+
+/// <summary>
+/// Serve one client: read a request line, run the request, and reply with text lines ending with "END <exit code>".
+/// </summary>
+IAsyncAction HandleClientAsync(winrt::file_handle pipe, const HANDLE stop, WAM::Session& session, const Option& option, AnchorWindow& anchor)
+{
+    // Blocking pipe I/O runs on the thread pool so that clients are served concurrently
+    co_await winrt::resume_background();
+
+    auto reply = std::string{};
+    auto exitCode = EXIT_FAILURE;
+
+    try
+    {
+        const auto line = Pipe::ReadLine(pipe.get(), stop);
+
+        if (not line)
+        {
+            Trace::Write<Level::Warning>("A client disconnected, or sent no request within {} ms", Pipe::RequestTimeout.count());
+            co_return;
+        }
+
+        auto spec = WAM::ParseRequestSpec(*line);
+
+        if (not spec)
+        {
+            std::format_to(std::back_inserter(reply), "Error: {}\n", spec.error());
+        }
+        else
+        {
+            // Fields the client leaves out come from the server's options, as for --requestfile lines
+            for (const auto& [key, value] : option.Properties())
+            {
+                spec->Properties.try_emplace(key, value);
+            }
+
+            const auto provider = co_await session.GetProviderAsync();
+            const auto clientId = spec->ClientId.value_or(option.ClientId().value_or(WAM::ClientId::MSOFFICE));
+            const auto scopes = spec->Scopes.value_or(option.Scopes().value_or(WAM::Scopes::DEFAULT_SCOPES));
+            const auto promptType = spec->Interactive ? WebTokenRequestPromptType::ForceAuthentication : WebTokenRequestPromptType::Default;
+
+            Logger::WriteLine(L"Client request: clientId:{}; scopes:'{}'; interactive:{}", clientId, scopes, spec->Interactive);
+
+            const auto request = GetWebTokenRequest(provider, promptType, clientId, scopes, spec->Properties);
+            const auto account = option.BindAccount() && not spec->Interactive
+                ? WAM::SelectAccount(co_await session.FindAllAccountsAsync(provider, clientId), spec->LoginHint())
+                : WebAccount{ nullptr };
+
+            // The interactive call is made on the thread that owns the window, and the pipe I/O goes back to the thread pool after it
+            if (spec->Interactive)
+            {
+                co_await anchor.ResumeOnLoopThread();
+            }
+
+            const auto start = Benchmark::Clock::now();
+            const auto requestResult = spec->Interactive
+                ? co_await InvokeRequestTokenAsync(session.Wam(), request, anchor.Get(), session.RetryPolicy())
+                : co_await InvokeGetTokenSilentlyAsync(session.Wam(), request, account, session.RetryPolicy());
+            const auto latency = Benchmark::Milliseconds{ Benchmark::Clock::now() - start };
+
+            if (spec->Interactive)
+            {
+                co_await winrt::resume_background();
+            }
+            const auto requestStatus = requestResult.ResponseStatus();
+
+            Logger::WriteLine("Client request's ResponseStatus: {}; Latency: {:.3f} ms", requestStatus, latency.count());
+            std::format_to(std::back_inserter(reply), "ResponseStatus: {}\nLatency: {:.3f} ms\n", requestStatus, latency.count());
+
+            const auto appendError = [&reply](const WebProviderError& error) {
+                if (error)
+                {
+                    std::format_to(std::back_inserter(reply), "ErrorCode: {:#x}; ErrorMessage: ", static_cast<std::uint32_t>(error.ErrorCode()));
+                    Util::to_string(error.ErrorMessage(), reply);
+                    reply.push_back('\n');
+                }
+            };
+
+            if (requestStatus == WebTokenRequestStatus::Success)
+            {
+                const auto response = requestResult.ResponseData().GetAt(0);
+
+                reply.append("WebAccount Id: ");
+                Util::to_string(response.WebAccount().Id(), reply);
+                reply.push_back('\n');
+
+                if (const auto lifetime = GetTokenLifetime(response))
+                {
+                    if (lifetime->Age)
+                    {
+                        std::format_to(std::back_inserter(reply), "TokenAge: {}\n", *lifetime->Age);
+                    }
+
+                    if (lifetime->Remaining)
+                    {
+                        std::format_to(std::back_inserter(reply), "TokenRemainingLifetime: {}\n", *lifetime->Remaining);
+                    }
+                }
+
+                auto scratch = std::wstring{};
+
+                for (const auto& [key, value] : response.Properties())
+                {
+                    Util::to_string(key, reply);
+                    reply.push_back('=');
+                    Util::to_string(Redact::Apply(key, value, scratch), reply);
+                    reply.push_back('\n');
+                }
+
+                appendError(response.ProviderError());
+                exitCode = EXIT_SUCCESS;
+            }
+            else
+            {
+                appendError(requestResult.ResponseError());
+            }
+        }
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"Client request failed with an exception. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+        std::format_to(std::back_inserter(reply), "Error: code:{:#x}; message:", static_cast<std::uint32_t>(e.code()));
+        Util::to_string(e.message(), reply);
+        reply.push_back('\n');
+    }
+
+    std::format_to(std::back_inserter(reply), "END {}\n", exitCode);
+
+    try
+    {
+        Pipe::WriteAll(pipe.get(), reply, stop);
+        ::FlushFileBuffers(pipe.get());
+        ::DisconnectNamedPipe(pipe.get());
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        Trace::Write<Level::Warning>(L"Failed to reply to a client. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+    }
+}
+
+/// <summary>
+/// Send this run's request (--clientid, --scopes & --property) to a --serve instance and print the reply as it arrives.
+/// </summary>
+/// <returns>The exit code of the request on the server</returns>
+int RunClient(const Option& option) noexcept
+{
+    try
+    {
+        const auto spec = WAM::RequestSpec{
+            .ClientId = option.ClientId(),
+            .Scopes = option.Scopes(),
+            .Interactive = option.Mode() == RequestMode::Interactive,
+            .Properties = option.Properties()
+        };
+
+        const auto pipe = Pipe::Connect(Pipe::GetPipePath(option.PipeName()), std::chrono::seconds{ 5 });
+        Pipe::WriteAll(pipe.get(), WAM::FormatRequestSpec(spec));
+
+        auto exitCode = EXIT_FAILURE;
+        auto pending = std::string{};
+        char buffer[4096];
+        auto read = DWORD{};
+
+        while (::ReadFile(pipe.get(), buffer, sizeof(buffer), &read, nullptr) && read > 0)
+        {
+            pending.append(buffer, read);
+
+            auto begin = std::size_t{ 0 };
+
+            for (auto end = pending.find('\n'); end != std::string::npos; begin = end + 1, end = pending.find('\n', begin))
+            {
+                const auto line = std::string_view{ pending }.substr(begin, end - begin);
+
+                if (line.starts_with("END "))
+                {
+                    std::from_chars(line.data() + 4, line.data() + line.size(), exitCode);
+                }
+                else
+                {
+                    Console::WriteLineRaw(line);
+                }
+            }
+
+            pending.erase(0, begin);
+        }
+
+        return exitCode;
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        Console::WriteLine(ConsoleFormat::Error, L"Failed to send the request to the server. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+        return EXIT_FAILURE;
+    }
+}
+
+void PrintWebTokenResponse(const WebTokenResponse& response) noexcept
+{
+    // The whole dump goes to the console in one write
+    auto block = Console::Block{};
+
+    Logger::WriteLine(L"  WebAccount Id:{}", response.WebAccount().Id());
+
+    if (const auto lifetime = GetTokenLifetime(response))
+    {
+        const auto describe = [](const std::optional<std::chrono::seconds>& value) {
+            return value ? std::format("{}", *value) : std::string{ "n/a" };
+        };
+
+        Logger::WriteLine("  Token age: {}; Remaining lifetime: {}", describe(lifetime->Age), describe(lifetime->Remaining));
+    }
+    else
+    {
+        Logger::WriteLine<Level::Verbose>("  Token is not a JWT (no iat/exp claims to report)");
+    }
+    Logger::WriteLine("  WebTokenResponse Properties:\n");
+
+    // Token values are redacted (see --redact) while still UTF-16, so they are never converted or formatted in full
+    if (Trace::IsLevelEnabled<Level::Verbose>())
+    {
+        auto scratch = std::wstring{};
+
+        for (const auto& [key, value] : response.Properties())
+        {
+            Logger::WriteLine<Level::Verbose>(L"  [{},{}]", key, Redact::Apply(key, value, scratch));
+        }
+    }
+
+    // Print response's error if any
+    PrintProviderError(response.ProviderError());
+}
+
+/// <summary>
+/// Print a table of the durations of WAM operations
+/// </summary>
+void PrintTimingSummary() noexcept
+{
+    const auto stats = Timing::GetStats();
+
+    if (stats.empty())
+    {
+        return;
+    }
+
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+
+    auto block = Console::Block{};
+
+    Logger::WriteLine("");
+    Logger::WriteLine("Timing summary (ms):");
+    Logger::WriteLine("  {:<36}{:>8}{:>12}{:>12}{:>12}{:>12}", "Phase", "Count", "Total", "Min", "Mean", "Max");
+
+    for (const auto& phase : stats)
+    {
+        const auto total = Milliseconds{ phase.Total };
+
+        Logger::WriteLine("  {:<36}{:>8}{:>12.3f}{:>12.3f}{:>12.3f}{:>12.3f}",
+            phase.Phase, phase.Count, total.count(), Milliseconds{ phase.Min }.count(), total.count() / phase.Count, Milliseconds{ phase.Max }.count());
+    }
+}
+
+/// <summary>
+/// Print the first, last & peak value of each resource counter per sampled process (--counters).
+/// A change between the first & last sample that stays after a long run points to a leak rather than a warm-up.
+/// </summary>
+void PrintCounterSummary(const Option& option, const std::vector<Counters::ProcessStats>& stats) noexcept
+{
+    if (stats.empty())
+    {
+        return;
+    }
+
+    using Counters::Sample;
+    using Counter = std::uint64_t(*)(const Sample&);
+
+    struct Row
+    {
+        std::string_view Name;
+        std::string_view JsonKey;
+        Counter Get;
+        bool SelfOnly = false;  // Allocations are counted in this process only
+    };
+
+    auto rows = std::vector<Row>{
+        { "Working set (KB)", "workingSetKB", [](const Sample& s) { return s.WorkingSet / 1024; } },
+        { "Private bytes (KB)", "privateKB", [](const Sample& s) { return s.PrivateBytes / 1024; } },
+        { "Handles", "handles", [](const Sample& s) { return std::uint64_t{ s.Handles }; } },
+        { "Threads", "threads", [](const Sample& s) { return std::uint64_t{ s.Threads }; } }
+    };
+
+    if constexpr (Counters::CountsAllocations())
+    {
+        rows.push_back({ "Allocations", "allocations", [](const Sample& s) { return s.Allocations; }, true });
+        rows.push_back({ "Live allocations", "liveAllocations", [](const Sample& s) { return s.LiveAllocations; }, true });
+    }
+
+    try
+    {
+        auto block = Console::Block{};
+
+        Logger::WriteLine("");
+        Logger::WriteLine("Resource counters (sampled every {} ms):", option.CounterInterval().count());
+
+        for (const auto& process : stats)
+        {
+            const auto elapsed = Benchmark::Milliseconds{ process.Last.Time - process.First.Time };
+            const auto isSelf = process.ProcessId == GetCurrentProcessId();
+
+            Logger::WriteLine("  {} (pid {}, {} samples over {:.0f} ms)", process.Name, process.ProcessId, process.Count, elapsed.count());
+            Logger::WriteLine("    {:<20}{:>14}{:>14}{:>14}{:>14}", "Counter", "First", "Last", "Peak", "Change");
+
+            for (const auto& row : rows)
+            {
+                if (row.SelfOnly && not isSelf)
+                {
+                    continue;
+                }
+
+                const auto first = row.Get(process.First);
+                const auto last = row.Get(process.Last);
+                Logger::WriteLine("    {:<20}{:>14}{:>14}{:>14}{:>+14}", row.Name, first, last, row.Get(process.Peak), static_cast<std::int64_t>(last - first));
+            }
+
+            if (option.Output() == OutputFormat::JsonLines)
+            {
+                Json::WriteLine([&](Json::Writer& json) {
+                    json.Field("phase", "Counters")
+                        .Field("process", process.Name)
+                        .Field("pid", process.ProcessId)
+                        .Field("samples", process.Count)
+                        .Field("durationMs", elapsed.count());
+
+                    for (const auto& row : rows)
+                    {
+                        if (row.SelfOnly && not isSelf)
+                        {
+                            continue;
+                        }
+
+                        json.Key(row.JsonKey).BeginObject()
+                            .Field("first", row.Get(process.First))
+                            .Field("last", row.Get(process.Last))
+                            .Field("peak", row.Get(process.Peak))
+                            .EndObject();
+                    }
+                });
+            }
+        }
+    }
+    catch (...)
+    {
+    }
+}
+
+/// <summary>
+/// Write a JSON Lines record of a token request (--output jsonl).
+/// Only the allow-listed response properties (see Redact::IsAllowed) are included; tokens are never written.
+/// </summary>
+void WriteJsonRecord(const std::string_view phase, const Benchmark::Clock::duration duration, const WebTokenRequest& request, const WebTokenRequestResult& result) noexcept
+{
+    try
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            const auto status = result.ResponseStatus();
+
+            json.Field("phase", phase)
+                .Field("status", to_string(status))
+                .Field("durationMs", Benchmark::Milliseconds{ duration }.count())
+                .Field("correlationId", request.CorrelationId())
+                .Field("clientId", request.ClientId())
+                .Field("scopes", request.Scope());
+
+            auto error = result.ResponseError();
+
+            if (status == WebTokenRequestStatus::Success)
+            {
+                const auto response = result.ResponseData().GetAt(0);
+                error = response.ProviderError();
+
+                if (const auto account = response.WebAccount())
+                {
+                    json.Field("accountId", account.Id()).Field("userName", account.UserName());
+                }
+
+                if (const auto lifetime = GetTokenLifetime(response))
+                {
+                    if (lifetime->Age)
+                    {
+                        json.Field("tokenAgeSec", lifetime->Age->count());
+                    }
+
+                    if (lifetime->Remaining)
+                    {
+                        json.Field("tokenRemainingSec", lifetime->Remaining->count());
+                    }
+                }
+
+                json.Key("properties").BeginObject();
+
+                for (const auto& [key, value] : response.Properties())
+                {
+                    if (Redact::IsAllowed(Redact::GetPolicy(), key))
+                    {
+                        json.Key(key).String(value);
+                    }
+                }
+
+                json.EndObject();
+            }
+
+            if (error)
+            {
+                json.Field("errorCode", static_cast<std::uint32_t>(error.ErrorCode())).Field("errorMessage", error.ErrorMessage());
+            }
+        });
+    }
+    catch (const winrt::hresult_error& e)
+    {
+        Trace::Write<Level::Error>(L"Failed to write a JSON record. code:{:#x}; message:{}", static_cast<std::uint32_t>(e.code()), e.message());
+    }
+}
+
+void WriteJsonRecord(const std::string_view phase, const winrt::hresult_error& error) noexcept
+{
+    try
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", phase)
+                .Field("status", "Exception")
+                .Field("errorCode", static_cast<std::uint32_t>(error.code()))
+                .Field("errorMessage", error.message());
+        });
+    }
+    catch (const std::exception& e)
+    {
+        Trace::Write<Level::Error>("Failed to write a JSON record. {}", e.what());
+    }
+}
+
+void WriteJsonRecord(const Retry::Attempt& attempt) noexcept
+{
+    try
+    {
+        Json::WriteLine([&](Json::Writer& json) {
+            json.Field("phase", "Attempt")
+                .Field("operation", attempt.Phase)
+                .Field("attempt", attempt.Number)
+                .Field("attempts", attempt.Count)
+                .Field("outcome", Retry::to_string(attempt.Result))
+                .Field("durationMs", Benchmark::Milliseconds{ attempt.Latency }.count());
+
+            if (attempt.Result == Retry::Outcome::Failed)
+            {
+                json.Field("errorCode", static_cast<std::uint32_t>(attempt.Error));
+            }
+        });
+    }
+    catch (const std::exception& e)
+    {
+        Trace::Write<Level::Error>("Failed to write a JSON record. {}", e.what());
+    }
+}
+
+/// <summary>
+/// Token age (now - iat) & remaining lifetime (exp - now) from the JWT claims of the response's token.
+/// </summary>
+/// <returns>nullopt if the token is not a JWT</returns>
+std::optional<Jwt::Lifetime> GetTokenLifetime(const WebTokenResponse& response) noexcept
+{
+    try
+    {
+        if (const auto claims = Jwt::DecodeClaims(response.Token()))
+        {
+            return Jwt::GetLifetime(*claims);
+        }
+    }
+    catch (...)
+    {
+        // Not being able to decode the token is not an error of the request
+    }
+
+    return std::nullopt;
+}
+
+void PrintProviderError(const WebProviderError& error) noexcept
+{
+    // ResponseError might be null (e.g. when status is WebTokenRequestStatus::UserCancel)
+    if (error)
+    {
+        Logger::WriteLine<Level::Error>(ConsoleFormat::Error, L"ErrorCode: {:#x}; ErrorMessage: {}", static_cast<std::uint32_t>(error.ErrorCode()), error.ErrorMessage());
+    }
+}
+
+LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    switch (msg)
+    {
+    case WM_DESTROY:
+        PostQuitMessage(0);
+        return 0;
+
+    default:
+        return DefWindowProc(hwnd, msg, wParam, lParam);
+    }
+}
+
+HWND CreateAnchorWindow()
+{
+    WNDCLASSEX wndclass{
+    .cbSize = sizeof(WNDCLASSEX),
+    .style = CS_HREDRAW | CS_VREDRAW,
+    .lpfnWndProc = WndProc,
+    .cbClsExtra = 0,
     .cbWndExtra = 0,
     .hInstance = GetModuleHandleW(nullptr),
     .hIcon = LoadIcon(NULL, IDI_APPLICATION),
@@ -379,7 +2327,7 @@ void PrintWebAccount(const WebAccount& account) noexcept
 
     for (const auto& [key, value] : account.Properties())
     {
-        Logger::WriteLine(L"  [{},{}]", key, value);
+        Logger::WriteLine<Level::Verbose>(L"  [{},{}]", key, value);
     }
 }
 
@@ -402,11 +2350,18 @@ void EnableTrace(const Option& option) noexcept
         auto fileName = exePath.stem();
         fileName += "_";
         fileName += std::format(L"{0:%Y%m%d}_{0:%H%M%S}", time_point_cast<seconds>(system_clock::now()));
-        fileName.replace_extension(L"log");
+        const auto format = option.TraceFormat().value_or(Trace::TraceFormat::Csv);
+        fileName.replace_extension(format == Trace::TraceFormat::Binary ? L"bin" : L"log");
 
         path /= fileName;
 
-        Trace::Enable(path);
+        Trace::Enable(path, Trace::TraceOptions{
+            .Format = format,
+            .BufferSize = static_cast<std::size_t>(option.TraceBufferSize()),
+            .Overflow = option.TraceOverflow().value_or(Trace::OverflowPolicy::Block),
+            .FlushInterval = option.TraceFlushInterval(),
+            .MaxFileSize = static_cast<std::size_t>(option.TraceMaxSize()),
+            .MaxFiles = static_cast<std::size_t>(option.TraceFiles()) });
     }
     catch (const std::exception& e)
     {
@@ -414,6 +2369,27 @@ void EnableTrace(const Option& option) noexcept
     }
 }
 
+/// <summary>
+/// Convert a binary trace file to CSV next to it
+/// </summary>
+int ConvertTrace(const std::filesystem::path& binaryPath) noexcept
+{
+    auto csvPath = binaryPath;
+    csvPath.replace_extension(L"csv");
+
+    try
+    {
+        Trace::ConvertToCsv(binaryPath, csvPath);
+        Console::WriteLine("Converted {} to {}", binaryPath.string(), csvPath.string());
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception& e)
+    {
+        Console::WriteLine(ConsoleFormat::Error, "Failed to convert {}. {}", binaryPath.string(), e.what());
+        return EXIT_FAILURE;
+    }
+}
+
 /// <summary>
 /// Parse input options. On failure, it returns an error message.
 /// </summary>
@@ -439,6 +2415,119 @@ std::expected<Option, std::string> ParseOption(int argc, char** argv) noexcept
             return std::unexpected{ error };
         }
 
+        if (option.Iterations() && *option.Iterations() < 1)
+        {
+            return std::unexpected{ "--iterations must be greater than 0" };
+        }
+
+        if (option.Concurrency() < 1)
+        {
+            return std::unexpected{ "--concurrency must be greater than 0" };
+        }
+
+        if (option.TraceBufferSize() < 1)
+        {
+            return std::unexpected{ "--tracebuffer must be greater than 0" };
+        }
+
+        if (option.TraceFlushInterval().count() < 0)
+        {
+            return std::unexpected{ "--traceflush must not be negative" };
+        }
+
+        if (option.TraceMaxSize() < 0)
+        {
+            return std::unexpected{ "--tracemaxsize must not be negative" };
+        }
+
+        if (option.TraceFiles() < 1)
+        {
+            return std::unexpected{ "--tracefiles must be greater than 0" };
+        }
+
+        if (option.CounterInterval().count() < 0)
+        {
+            return std::unexpected{ "--counters must not be negative" };
+        }
+
+        if (not option.LogLevel())
+        {
+            return std::unexpected{ "--loglevel must be one of error, warning, info, verbose, or debug" };
+        }
+
+        if (not option.TraceFormat())
+        {
+            return std::unexpected{ "--traceformat must be either csv or binary" };
+        }
+
+        if (not option.TraceOverflow())
+        {
+            return std::unexpected{ "--traceoverflow must be one of block, drop-oldest, or count-dropped" };
+        }
+
+        if (option.CacheThreshold().count() < 0)
+        {
+            return std::unexpected{ "--cachethreshold must not be negative" };
+        }
+
+        if (not option.RedactMode())
+        {
+            return std::unexpected{ "--redact must be one of none, truncate, or hash" };
+        }
+
+        if (not option.Mode())
+        {
+            return std::unexpected{ "--mode must be one of silent, interactive, both, or parallel" };
+        }
+
+        if (not option.Output())
+        {
+            return std::unexpected{ "--output must be either text or jsonl" };
+        }
+
+        if (option.Timeout().count() < 0)
+        {
+            return std::unexpected{ "--timeout must not be negative" };
+        }
+
+        if (option.Retries() < 0)
+        {
+            return std::unexpected{ "--retries must not be negative" };
+        }
+
+        if (option.Serve() && option.Client())
+        {
+            return std::unexpected{ "--serve and --client cannot be used together" };
+        }
+
+        if (option.RequestFile() && (option.Iterations() || option.Serve() || option.Client()))
+        {
+            return std::unexpected{ "--requestfile cannot be used with --iterations, --serve or --client" };
+        }
+
+        if (option.Bench() && (option.RequestFile() || option.AllAccounts() || option.Serve() || option.Client()))
+        {
+            return std::unexpected{ "--bench cannot be used with --requestfile, --allaccounts, --serve or --client" };
+        }
+
+        if (const auto synthetic = option.Synthetic())
+        {
+            if (const auto config = WAM::ParseSyntheticConfig(*synthetic); not config)
+            {
+                return std::unexpected{ "--synthetic: " + config.error() };
+            }
+        }
+
+        if (option.BenchThreshold() < 0)
+        {
+            return std::unexpected{ "--benchthreshold must not be negative" };
+        }
+
+        if (option.AllAccounts() && (option.Iterations() || option.RequestFile() || option.Serve() || option.Client()))
+        {
+            return std::unexpected{ "--allaccounts cannot be used with --iterations, --requestfile, --serve or --client" };
+        }
+
         return option;
     }
     catch (...)
@@ -449,38 +2538,114 @@ std::expected<Option, std::string> ParseOption(int argc, char** argv) noexcept
 
 namespace Logger
 {
+    namespace detail
+    {
+        auto consoleEnabled = true;
+
+        /// <summary>
+        /// Format into a per-thread buffer. The returned view is valid until the next call on the same thread.
+        /// </summary>
+        template <typename... Args>
+        std::string_view Format(const std::format_string<Args...> format, Args&&... args)
+        {
+            thread_local auto buffer = std::string{};
+            buffer.clear();
+            std::format_to(std::back_inserter(buffer), format, std::forward<Args>(args)...);
+            return buffer;
+        }
+
+        /// <summary>
+        /// Format into a per-thread wide buffer, then convert to UTF-8 once into another per-thread buffer.
+        /// The returned view is valid until the next call on the same thread.
+        /// </summary>
+        template <typename... Args>
+        std::string_view Format(const std::wformat_string<Args...> format, Args&&... args)
+        {
+            thread_local auto wbuffer = std::wstring{};
+            thread_local auto buffer = std::string{};
+            wbuffer.clear();
+            buffer.clear();
+            std::format_to(std::back_inserter(wbuffer), format, std::forward<Args>(args)...);
+            Util::to_string(wbuffer, buffer);
+            return buffer;
+        }
+    }
+
+    void EnableConsole(bool enable) noexcept
+    {
+        detail::consoleEnabled = enable;
+    }
+
     /// <summary>
-    /// Write message to both console & log file
+    /// Write message to both console & log file.
+    /// The message is formatted (and converted to UTF-8) once and the same bytes go to both.
+    /// Nothing is formatted when the level is filtered out.
     /// </summary>
-    template <typename... Args>
+    template <Level level, typename... Args>
     void WriteLine(const std::format_string<Args...> format, Args&&... args) noexcept
     {
-        auto message = std::format(format, std::forward<Args>(args)...);
-        Trace::Write("{}", message);
-        Console::WriteLine("{}", message);
+        if (not Trace::IsLevelEnabled<level>())
+        {
+            return;
+        }
+
+        const auto message = detail::Format(format, std::forward<Args>(args)...);
+        Trace::WriteRaw<level>(message);
+
+        if (detail::consoleEnabled)
+        {
+            Console::WriteLineRaw(message);
+        }
     }
 
-    template <typename... Args>
-    void WriteLine(const std::initializer_list<Console::Format>& consoleFormat, const std::format_string<Args...> format, Args&&... args) noexcept
+    template <Level level, typename... Args>
+    void WriteLine(const Console::Style& consoleFormat, const std::format_string<Args...> format, Args&&... args) noexcept
     {
-        auto message = std::format(format, std::forward<Args>(args)...);
-        Trace::Write("{}", message);
-        Console::WriteLine(consoleFormat, "{}", message);
+        if (not Trace::IsLevelEnabled<level>())
+        {
+            return;
+        }
+
+        const auto message = detail::Format(format, std::forward<Args>(args)...);
+        Trace::WriteRaw<level>(message);
+
+        if (detail::consoleEnabled)
+        {
+            Console::WriteLineRaw(consoleFormat, message);
+        }
     }
 
-    template <typename... Args>
+    template <Level level, typename... Args>
     void WriteLine(const std::wformat_string<Args...> format, Args&&... args) noexcept
     {
-        auto message = std::format(format, std::forward<Args>(args)...);
-        Trace::Write(L"{}", message);
-        Console::WriteLine(L"{}", message);
+        if (not Trace::IsLevelEnabled<level>())
+        {
+            return;
+        }
+
+        const auto message = detail::Format(format, std::forward<Args>(args)...);
+        Trace::WriteRaw<level>(message);
+
+        if (detail::consoleEnabled)
+        {
+            Console::WriteLineRaw(message);
+        }
     }
 
-    template <typename... Args>
-    void WriteLine(const std::initializer_list<Console::Format>& consoleFormat, const std::wformat_string<Args...> format, Args&&... args) noexcept
+    template <Level level, typename... Args>
+    void WriteLine(const Console::Style& consoleFormat, const std::wformat_string<Args...> format, Args&&... args) noexcept
     {
-        auto message = std::format(format, std::forward<Args>(args)...);
-        Trace::Write(L"{}", message);
-        Console::WriteLine(consoleFormat, L"{}", message);
+        if (not Trace::IsLevelEnabled<level>())
+        {
+            return;
+        }
+
+        const auto message = detail::Format(format, std::forward<Args>(args)...);
+        Trace::WriteRaw<level>(message);
+
+        if (detail::consoleEnabled)
+        {
+            Console::WriteLineRaw(consoleFormat, message);
+        }
     }
 }
\ No newline at end of file
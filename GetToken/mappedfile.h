@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#ifndef  NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <Windows.h>
+
+#include "util.h"
+
+namespace Util
+{
+    /// <summary>
+    /// A new file of a fixed size, mapped for writing. The size is reserved up front, so filling the view needs no
+    /// further allocation on disk, and Close() cuts the file down to the bytes actually used.
+    /// If the process ends without Close(), the file keeps its full size with a zero-filled tail.
+    /// </summary>
+    class MappedFile final
+    {
+    public:
+        /// <summary>
+        /// Create (or overwrite) the file with the given size and map all of it. Throws std::runtime_error on failure.
+        /// </summary>
+        MappedFile(const std::filesystem::path& path, std::size_t size) : _size{ size }
+        {
+            _file.attach(::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+            if (not _file)
+            {
+                throw std::runtime_error{ std::format("Failed to open {}. CreateFileW failed with {}", Util::to_string(path.c_str()), ::GetLastError()) };
+            }
+
+            // Mapping a larger size than the file extends it
+            const auto size64 = static_cast<std::uint64_t>(size);
+            _mapping.attach(::CreateFileMappingW(_file.get(), nullptr, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), nullptr));
+
+            if (not _mapping)
+            {
+                throw std::runtime_error{ std::format("Failed to map {}. CreateFileMappingW failed with {}", Util::to_string(path.c_str()), ::GetLastError()) };
+            }
+
+            _view = static_cast<char*>(::MapViewOfFile(_mapping.get(), FILE_MAP_WRITE, 0, 0, size));
+
+            if (not _view)
+            {
+                throw std::runtime_error{ std::format("Failed to map {}. MapViewOfFile failed with {}", Util::to_string(path.c_str()), ::GetLastError()) };
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile()
+        {
+            Close();
+        }
+
+        char* Data() noexcept
+        {
+            return _view;
+        }
+
+        std::size_t Size() const noexcept
+        {
+            return _size;
+        }
+
+        /// <summary>
+        /// Unmap the view and truncate the file to the first "used" bytes. Later calls do nothing.
+        /// </summary>
+        void Close(std::size_t used) noexcept
+        {
+            if (not _view)
+            {
+                return;
+            }
+
+            // The file cannot be truncated while it is mapped
+            ::UnmapViewOfFile(_view);
+            _view = nullptr;
+            _mapping.close();
+
+            auto end = LARGE_INTEGER{};
+            end.QuadPart = static_cast<LONGLONG>(used < _size ? used : _size);
+
+            if (::SetFilePointerEx(_file.get(), end, nullptr, FILE_BEGIN))
+            {
+                ::SetEndOfFile(_file.get());
+            }
+
+            _file.close();
+        }
+
+        /// <summary>
+        /// Unmap and close the file at its full size
+        /// </summary>
+        void Close() noexcept
+        {
+            Close(_size);
+        }
+
+    private:
+        std::size_t _size = 0;
+        winrt::file_handle _file;
+        winrt::handle _mapping;
+        char* _view = nullptr;
+    };
+}
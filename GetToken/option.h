@@ -1,17 +1,41 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <format>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <winrt/base.h>
 
+#include "pipe.h"
 #include "popl.hpp"
+#include "redact.h"
+#include "retry.h"
+#include "trace.h"
 #include "util.h"
+#include "version.h"
 #include "wam.h"
 
+enum class RequestMode
+{
+    Silent,         // GetTokenSilentlyAsync only, e.g. for unattended probes
+    Interactive,    // RequestTokenAsync only
+    Both,           // GetTokenSilentlyAsync, then RequestTokenAsync
+    Parallel        // Both at once
+};
+
+enum class OutputFormat
+{
+    Text,       // Human readable (colored) console output
+    JsonLines   // One JSON record per phase on stdout
+};
+
 class Option final
 {
 public:
@@ -21,18 +45,54 @@ public:
         m_helpAlias{ m_parser.add<popl::Switch>("?", "", "Show this help message") },
         m_version{ m_parser.add<popl::Switch>("v", "version", "Show version")},
         m_clientId{ m_parser.add<popl::Value<std::string>>("c", "clientid", std::format("Client ID. Default: {}", Util::to_string(WAM::ClientId::MSOFFICE))) },
-        m_scopes{ m_parser.add<popl::Value<std::string>>("", "scopes", std::format(R"(Scopes of the token. Default: "{}")", Util::to_string(WAM::Scopes::DEFAULT_SCOPES))) },
+        m_scopes{ m_parser.add<popl::Value<std::string>>("", "scopes", std::format(R"(Scopes of the token. Default: "{}". Can be used multiple times to request tokens for several scope sets concurrently)", Util::to_string(WAM::Scopes::DEFAULT_SCOPES))) },
         m_properties{ m_parser.add<popl::Value<std::string>>("p", "property", "Request property (e.g., longin_hint=user01@example.com, prompt=login). Can be used multiple times") },
         m_showAccounts { m_parser.add<popl::Switch>("", "showaccounts", "Show Web Accounts and exit") },
         m_signOut{ m_parser.add<popl::Switch>("", "signout", "Sign out of Web Accounts") },
+        m_mode{ m_parser.add<popl::Value<std::string>>("", "mode", "Token requests to make: silent, interactive, both (one after the other), or parallel (both at once)", "both") },
+        m_iterations{ m_parser.add<popl::Value<int>>("", "iterations", "Run a load test with the given number of GetTokenSilentlyAsync calls (or take that many samples per --bench scenario)") },
+        m_refreshAccounts{ m_parser.add<popl::Switch>("", "refreshaccounts", "Look up the provider & accounts again for every request instead of reusing them") },
+        m_bindAccount{ m_parser.add<popl::Switch>("", "bindaccount", "Pass the found WebAccount (matching login_hint if given) to GetTokenSilentlyAsync") },
+        m_allAccounts{ m_parser.add<popl::Switch>("", "allaccounts", "Request a token silently for every found account, with up to --concurrency requests in flight, and print a table per account") },
+        m_accountFilter{ m_parser.add<popl::Value<std::string>>("", "accountfilter", "With --allaccounts, only the accounts whose UserName contains the given text (case-insensitive)") },
+        m_concurrency{ m_parser.add<popl::Value<int>>("", "concurrency", "Number of token requests in flight during a load test, with --requestfile, or with --allaccounts", 1) },
+        m_cacheThreshold{ m_parser.add<popl::Value<int>>("", "cachethreshold", "In a load test, latency in milliseconds up to which a request counts as cache-served when the token has no iat claim", 50) },
+        m_requestFile{ m_parser.add<popl::Value<std::string>>("", "requestfile", "Run the requests of a file (or - for standard input), one line each of tab separated key=value fields: clientid, scopes, interactive, or a request property") },
+        m_bench{ m_parser.add<popl::Switch>("", "bench", "Run fixed latency scenarios (provider lookup, account lookup, cold & warm silent token, trace & console overhead) and compare them with --baseline") },
+        m_baseline{ m_parser.add<popl::Value<std::string>>("", "baseline", "JSON Lines file of --bench results to compare with. Written if it does not exist yet") },
+        m_saveBaseline{ m_parser.add<popl::Switch>("", "savebaseline", "Write the --bench results to --baseline even if it exists") },
+        m_benchThreshold{ m_parser.add<popl::Value<double>>("", "benchthreshold", "Percent by which a --bench scenario's p50 or p90 may exceed the baseline before it counts as a regression", 20.0) },
+        m_synthetic{ m_parser.add<popl::Value<std::string>>("", "synthetic", "Answer the WAM calls with a synthetic broker instead, for offline measurements. Comma separated key=value: median & p99 latency in ms, error & throw rates (0-1), accounts (0-1000). p99 must exceed median. e.g. median=5,p99=40,error=0.01") },
+        m_serve{ m_parser.add<popl::Switch>("", "serve", "Serve token requests over a named pipe until Ctrl+C, reusing the provider & accounts") },
+        m_client{ m_parser.add<popl::Switch>("", "client", "Send the request to a running --serve instance and print its reply") },
+        m_pipe{ m_parser.add<popl::Value<std::string>>("", "pipe", "Name of the pipe for --serve & --client", Util::to_string(Pipe::DefaultName)) },
+        m_output{ m_parser.add<popl::Value<std::string>>("", "output", "Console output format: text, or jsonl for one JSON record per phase on stdout (errors go to stderr)", "text") },
+        m_redact{ m_parser.add<popl::Value<std::string>>("", "redact", "How to print long response property values such as tokens: none, truncate, or hash", "truncate") },
+        m_allowProperty{ m_parser.add<popl::Value<std::string>>("", "allowproperty", "Response property to print in full regardless of --redact. Can be used multiple times") },
+        m_timeout{ m_parser.add<popl::Value<int>>("", "timeout", "Cancel a WAM call that takes longer than the given milliseconds. 0 waits forever", 0) },
+        m_retries{ m_parser.add<popl::Value<int>>("", "retries", "Retry a timed-out or failed WAM call up to the given times, with jittered exponential backoff", 0) },
         m_notrace { m_parser.add<popl::Switch>("n", "notrace", "Disable trace" )},
+        m_etw{ m_parser.add<popl::Switch>("", "etw", "Also send trace messages to ETW as TraceLogging provider \"GetToken\". Works with --notrace") },
         m_tracePath{ m_parser.add<popl::Value<std::string>>("t", "tracepath", "Folder path for a trace file") },
+        m_traceFormat{ m_parser.add<popl::Value<std::string>>("", "traceformat", "Trace file format: csv or binary. Use --convert to read a binary trace", "csv") },
+        m_convert{ m_parser.add<popl::Value<std::string>>("", "convert", "Convert the given binary trace file to CSV and exit") },
+        m_traceBuffer{ m_parser.add<popl::Value<int>>("", "tracebuffer", "Number of preallocated slots in the trace buffer", 4096) },
+        m_traceOverflow{ m_parser.add<popl::Value<std::string>>("", "traceoverflow", "What to do when the trace buffer is full: block, drop-oldest, or count-dropped", "block") },
+        m_traceFlush{ m_parser.add<popl::Value<int>>("", "traceflush", "Interval in milliseconds to write buffered trace messages to the file. 0 writes them as they arrive", 0) },
+        m_traceMaxSize{ m_parser.add<popl::Value<int>>("", "tracemaxsize", "Size in MB of each trace file. A full file is closed and the trace continues in the next one (..._001.log, _002.log, ...), written through preallocated memory-mapped files. 0 writes a single file without limit", 0) },
+        m_traceFiles{ m_parser.add<popl::Value<int>>("", "tracefiles", "With --tracemaxsize, number of the newest trace files to keep. Older ones are deleted", 10) },
+        m_counters{ m_parser.add<popl::Value<int>>("", "counters", "Sample the working set, private bytes, handle & thread count every given milliseconds into the trace, and summarize them at exit. 0 turns it off", 0) },
+        m_counterBroker{ m_parser.add<popl::Switch>("", "counterbroker", "With --counters, also sample the broker process (Microsoft.AAD.BrokerPlugin)") },
+        m_chromeTrace{ m_parser.add<popl::Value<std::string>>("", "chrometrace", "Write every WAM call as a span keyed by its CorrelationId to the given file in Chrome trace JSON, to view the requests on a timeline in Perfetto (ui.perfetto.dev) or chrome://tracing") },
+        m_logLevel{ m_parser.add<popl::Value<std::string>>("", "loglevel", "Lowest severity to output: error, warning, info, verbose, or debug", "verbose") },
         m_wait{ m_parser.add<popl::Switch>("w", "wait", "Wait execution until user enters") }
-    { /* empty */ }
+    {
+        UpdateValues();
+    }
 
     Option(int argc, char** argv) : Option()
     {
-        m_parser.parse(argc, argv);
+        Parse(argc, argv);
     }
 
     // dtor, copy, and move are compiler-generated default.
@@ -40,6 +100,7 @@ public:
     void Parse(int argc, char** argv)
     {
         m_parser.parse(argc, argv);
+        UpdateValues();
     }
 
     const auto& UnknownOptions() const noexcept
@@ -67,80 +128,297 @@ public:
         return m_showAccounts->value();
     }
 
+    std::chrono::milliseconds Timeout() const noexcept
+    {
+        return std::chrono::milliseconds{ m_timeout->value() };
+    }
+
+    int Retries() const noexcept
+    {
+        return m_retries->value();
+    }
+
+    /// <summary>
+    /// Policy for the WAM calls from --timeout & --retries (inactive if neither is given)
+    /// </summary>
+    Retry::Policy RetryPolicy() const
+    {
+        auto policy = Retry::Policy{ .Retries = Retries() };
+
+        if (Timeout().count() > 0)
+        {
+            policy.Timeout = Timeout();
+        }
+
+        return policy;
+    }
+
     auto EnableTrace() const noexcept
     {
         // Trace is enabled by default, unless --notrace is specified
         return not m_notrace->value();
     }
 
+    auto Etw() const noexcept
+    {
+        return m_etw->value();
+    }
+
     const std::optional<winrt::hstring>& ClientId() const noexcept
     {
-        static auto value = [this]() -> std::optional<winrt::hstring> {
-            if (m_clientId->is_set())
-            {
-                return winrt::to_hstring(m_clientId->value());
-            }
+        return m_clientIdValue;
+    }
 
-            return std::nullopt;
-        }();
+    const std::optional<winrt::hstring>& Scopes() const noexcept
+    {
+        return m_scopesValue;
+    }
 
-        return value;
+    /// <summary>
+    /// Every --scopes value given. Each one is requested separately in batch mode.
+    /// </summary>
+    const std::vector<winrt::hstring>& ScopeSets() const noexcept
+    {
+        return m_scopeSetsValue;
     }
 
-    const std::optional<winrt::hstring>& Scopes() const noexcept
+    const std::unordered_map<winrt::hstring, winrt::hstring>& Properties() const noexcept
     {
-        static auto value = [this]() -> std::optional<winrt::hstring> {
-            if (m_scopes->is_set())
-            {
-                return winrt::to_hstring(m_scopes->value());
-            }
+        return m_propertiesValue;
+    }
 
-            return std::nullopt;
-        }();
+    const std::optional<std::filesystem::path>& TracePath() const noexcept
+    {
+        return m_tracePathValue;
+    }
+
+    std::optional<int> Iterations() const noexcept
+    {
+        if (m_iterations->is_set())
+        {
+            return m_iterations->value();
+        }
 
-        return value;
+        return std::nullopt;
     }
 
-    const std::unordered_map<winrt::hstring, winrt::hstring>& Properties() const
+    bool RefreshAccounts() const noexcept
     {
-        // Parse properties and put them in a map
-        // Property value should look like "key=value"
-        static auto value = [this]() {
-            auto map = std::unordered_map<winrt::hstring, winrt::hstring>{ m_properties->count() };
+        return m_refreshAccounts->value();
+    }
 
-            for (int i = 0; i < m_properties->count(); ++i)
-            {
-                const auto propValue = m_properties->value(i);
-                auto pos = propValue.find('=');
-
-                if (pos != std::string::npos)
-                {
-                    auto key = propValue.substr(0, pos);
-                    auto val = propValue.substr(pos + 1);
-                    map.emplace(winrt::to_hstring(key), winrt::to_hstring(val));
-                }
-            }
+    bool BindAccount() const noexcept
+    {
+        return m_bindAccount->value();
+    }
 
-            return map;
-        }();
+    bool AllAccounts() const noexcept
+    {
+        return m_allAccounts->value();
+    }
+
+    const std::optional<winrt::hstring>& AccountFilter() const noexcept
+    {
+        return m_accountFilterValue;
+    }
+
+    /// <summary>
+    /// Value of the "login_hint" request property if given
+    /// </summary>
+    const std::optional<winrt::hstring>& LoginHint() const noexcept
+    {
+        return m_loginHintValue;
+    }
+
+    int Concurrency() const noexcept
+    {
+        return m_concurrency->value();
+    }
+
+    std::chrono::milliseconds CacheThreshold() const noexcept
+    {
+        return std::chrono::milliseconds{ m_cacheThreshold->value() };
+    }
+
+    /// <summary>
+    /// Path of the request file, or "-" for standard input
+    /// </summary>
+    std::optional<std::filesystem::path> RequestFile() const
+    {
+        if (m_requestFile->is_set())
+        {
+            return m_requestFile->value();
+        }
+
+        return std::nullopt;
+    }
+
+    bool Bench() const noexcept
+    {
+        return m_bench->value();
+    }
+
+    const std::optional<std::filesystem::path>& BaselinePath() const noexcept
+    {
+        return m_baselineValue;
+    }
+
+    bool SaveBaseline() const noexcept
+    {
+        return m_saveBaseline->value();
+    }
+
+    double BenchThreshold() const noexcept
+    {
+        return m_benchThreshold->value();
+    }
+
+    /// <summary>
+    /// Config of the synthetic broker if given. See WAM::ParseSyntheticConfig
+    /// </summary>
+    std::optional<std::string> Synthetic() const
+    {
+        if (m_synthetic->is_set())
+        {
+            return m_synthetic->value();
+        }
+
+        return std::nullopt;
+    }
+
+    bool Serve() const noexcept
+    {
+        return m_serve->value();
+    }
 
-        return value;
+    bool Client() const noexcept
+    {
+        return m_client->value();
     }
 
-    const std::optional<std::filesystem::path>& TracePath() const
+    std::wstring PipeName() const
     {
-        static auto value = [this]() {
-            auto path = std::optional<std::filesystem::path>{};
+        return Util::to_wstring(m_pipe->value());
+    }
 
-            if (m_tracePath->is_set())
+    std::optional<RequestMode> Mode() const
+    {
+        constexpr std::pair<std::string_view, RequestMode> modes[] = {
+            { "silent", RequestMode::Silent },
+            { "interactive", RequestMode::Interactive },
+            { "both", RequestMode::Both },
+            { "parallel", RequestMode::Parallel }
+        };
+
+        for (const auto& [name, mode] : modes)
+        {
+            if (Util::EqualsIgnoreCase(m_mode->value(), name))
             {
-                path = m_tracePath->value();
+                return mode;
             }
+        }
 
-            return path;
-        }();
+        return std::nullopt;
+    }
+
+    std::optional<OutputFormat> Output() const
+    {
+        const auto& value = m_output->value();
+
+        if (Util::EqualsIgnoreCase(value, "text"))
+        {
+            return OutputFormat::Text;
+        }
+
+        if (Util::EqualsIgnoreCase(value, "jsonl"))
+        {
+            return OutputFormat::JsonLines;
+        }
+
+        return std::nullopt;
+    }
+
+    std::optional<Redact::Mode> RedactMode() const
+    {
+        return Redact::ParseMode(m_redact->value());
+    }
+
+    Redact::Policy RedactPolicy() const
+    {
+        auto policy = Redact::Policy{ .Redaction = RedactMode().value_or(Redact::Mode::Truncate) };
+
+        for (int i = 0; i < m_allowProperty->count(); ++i)
+        {
+            policy.AllowList.push_back(Util::to_wstring(m_allowProperty->value(i)));
+        }
+
+        return policy;
+    }
+
+    std::optional<Diagnostics::Trace::TraceFormat> TraceFormat() const
+    {
+        return Diagnostics::Trace::ParseTraceFormat(m_traceFormat->value());
+    }
+
+    std::optional<std::filesystem::path> ConvertPath() const
+    {
+        if (m_convert->is_set())
+        {
+            return m_convert->value();
+        }
+
+        return std::nullopt;
+    }
+
+    int TraceBufferSize() const noexcept
+    {
+        return m_traceBuffer->value();
+    }
+
+    std::optional<Diagnostics::Trace::OverflowPolicy> TraceOverflow() const
+    {
+        return Diagnostics::Trace::ParseOverflowPolicy(m_traceOverflow->value());
+    }
 
-        return value;
+    std::chrono::milliseconds TraceFlushInterval() const noexcept
+    {
+        return std::chrono::milliseconds{ m_traceFlush->value() };
+    }
+
+    /// <summary>
+    /// Size in bytes of each rotating trace file. Zero for a single file
+    /// </summary>
+    std::int64_t TraceMaxSize() const noexcept
+    {
+        return std::int64_t{ m_traceMaxSize->value() } * 1024 * 1024;
+    }
+
+    int TraceFiles() const noexcept
+    {
+        return m_traceFiles->value();
+    }
+
+    /// <summary>
+    /// Interval of the resource counter samples. Zero if not sampled
+    /// </summary>
+    std::chrono::milliseconds CounterInterval() const noexcept
+    {
+        return std::chrono::milliseconds{ m_counters->value() };
+    }
+
+    bool CounterBroker() const noexcept
+    {
+        return m_counterBroker->value();
+    }
+
+    const std::optional<std::filesystem::path>& ChromeTracePath() const noexcept
+    {
+        return m_chromeTraceValue;
+    }
+
+    std::optional<Diagnostics::Trace::Level> LogLevel() const
+    {
+        return Diagnostics::Trace::ParseLevel(m_logLevel->value());
     }
 
     bool Wait() const noexcept
@@ -150,11 +428,10 @@ public:
 
     std::string GetVersion() const
     {
+        // The version is compiled in (version.h), so only the module name is looked up
         static auto ver = []() {
-            const auto exePath = Util::GetModulePath(nullptr);
-            const auto exeName = exePath.stem();
-            auto version = Util::GetFileVersion(exePath);
-            return std::format("{} (version {})", exeName.string(), version.value_or(""));
+            const auto exeName = Util::GetModulePath(nullptr).stem();
+            return std::format("{} (version {})", exeName.string(), GETTOKEN_VERSION_DISPLAY_STRING);
         }();
 
         return ver;
@@ -185,12 +462,118 @@ Use the given scopes for the token
 
 Example 5: {0} --signout
 Sign out from all web accounts before making token requests
+
+Example 6: {0} --iterations 100 --concurrency 8
+Run 100 GetTokenSilentlyAsync calls with 8 calls in flight and report throughput & latency percentiles
+
+Example 7: {0} --iterations 10000 --traceformat binary
+Write a compact binary trace. Convert it to CSV later with: {0} --convert <path to .bin file>
+
+Example 8: {0} --iterations 100 --bindaccount -p login_hint=user01@example.com
+Measure GetTokenSilentlyAsync calls bound to the cached WebAccount. Add --refreshaccounts to look up the provider & accounts every time
+
+Example 9: {0} --scopes "https://outlook.office.com/.default" --scopes "https://graph.microsoft.com/.default"
+Request tokens for several scope sets concurrently and compare the wall time with the sum of latencies
+
+Example 10: {0} --serve
+Keep running and serve token requests over a named pipe. Then, from another console:
+  {0} --client --scopes "https://graph.microsoft.com/.default" -p login_hint=user01@example.com
+Fields a client leaves out (client ID, scopes, properties) come from the server's --clientid, --scopes & --property, as for --requestfile lines
+
+Example 11: {0} --output jsonl
+Write one JSON record per phase (status, error code, duration, correlation ID & selected properties) instead of the console text
+
+Example 12: {0} --redact hash --allowproperty wamcompat_client_info
+Print long property values as hashes except wamcompat_client_info. Use --redact none to print tokens in full
+
+Example 13: {0} --iterations 100 --loglevel debug
+Also trace each token's iat claim next to the latency, and whether the request was probably served from the broker's cache
+
+Example 14: {0} --notrace --etw
+Write no trace file, but send trace messages to ETW (e.g. record them with "wpr" or view them live with "tracelog" & "tracefmt")
+
+Example 15: {0} --timeout 5000 --retries 2
+Cancel a WAM call after 5 seconds and try it up to 2 more times. Each attempt's outcome & latency is traced and summarized
+
+Example 16: {0} --mode silent
+Make only the silent request, without showing any UI (e.g. for unattended probes)
+
+Example 17: type requests.txt | {0} --requestfile - --concurrency 4 --output jsonl
+Run one request per line of requests.txt, 4 at a time, e.g. lines like "scopes=https://graph.microsoft.com/.default<TAB>login_hint=user01@example.com"
+
+Example 18: {0} --allaccounts --accountfilter @contoso.com --concurrency 8
+Request a token for each signed-in account whose UserName contains @contoso.com, 8 at a time. Raise --concurrency to see where the broker starts throttling
+
+Example 19: {0} --bench --baseline bench.jsonl
+Measure the fixed scenarios and compare them with bench.jsonl (written by the first run). Add --savebaseline to make this run the new baseline
+
+Example 20: {0} --synthetic median=0 --iterations 1000000 --concurrency 64 --notrace
+Measure GetToken's own cost per request without a broker. Drop --notrace to include the trace, or set median & error to mimic a broker
+
+Example 21: {0} --iterations 100000 --concurrency 16 --counters 1000 --counterbroker
+Sample the memory, handles & threads of GetToken and the broker every second of a long run, to tell a leak from a warm-up
+
+Example 22: {0} --iterations 10000000 --tracemaxsize 64 --tracefiles 8
+Soak test with at most 8 trace files of 64 MB each; the oldest file is deleted when a new one starts
+
+Example 23: {0} --iterations 1000 --concurrency 16 --chrometrace requests.json
+Write each request's WAM call as a span to requests.json and open it in ui.perfetto.dev to see the overlap, queuing & tail latency
 )", exeName);
 
         return help;
     }
 
 private:
+    /// <summary>
+    /// Convert the parsed text values to the types handed out by the accessors. Runs after every parse, so the values
+    /// belong to this instance and follow a re-parse; accessors return them by reference without converting again.
+    /// </summary>
+    void UpdateValues()
+    {
+        m_clientIdValue = m_clientId->is_set() ? std::optional{ winrt::to_hstring(m_clientId->value()) } : std::nullopt;
+        m_scopesValue = m_scopes->is_set() ? std::optional{ winrt::to_hstring(m_scopes->value()) } : std::nullopt;
+
+        m_scopeSetsValue.clear();
+        m_scopeSetsValue.reserve(m_scopes->count());
+
+        for (int i = 0; i < m_scopes->count(); ++i)
+        {
+            m_scopeSetsValue.push_back(winrt::to_hstring(m_scopes->value(i)));
+        }
+
+        // Parse properties and put them in a map
+        // Property value should look like "key=value"
+        m_propertiesValue.clear();
+        m_propertiesValue.reserve(m_properties->count());
+
+        for (int i = 0; i < m_properties->count(); ++i)
+        {
+            const auto propValue = m_properties->value(i);
+            auto pos = propValue.find('=');
+
+            if (pos != std::string::npos)
+            {
+                auto key = propValue.substr(0, pos);
+                auto val = propValue.substr(pos + 1);
+                m_propertiesValue.emplace(winrt::to_hstring(key), winrt::to_hstring(val));
+            }
+        }
+
+        if (auto it = m_propertiesValue.find(L"login_hint"); it != m_propertiesValue.end())
+        {
+            m_loginHintValue = it->second;
+        }
+        else
+        {
+            m_loginHintValue.reset();
+        }
+
+        m_accountFilterValue = m_accountFilter->is_set() ? std::optional{ winrt::to_hstring(m_accountFilter->value()) } : std::nullopt;
+        m_baselineValue = m_baseline->is_set() ? std::optional<std::filesystem::path>{ m_baseline->value() } : std::nullopt;
+        m_chromeTraceValue = m_chromeTrace->is_set() ? std::optional<std::filesystem::path>{ m_chromeTrace->value() } : std::nullopt;
+        m_tracePathValue = m_tracePath->is_set() ? std::optional<std::filesystem::path>{ m_tracePath->value() } : std::nullopt;
+    }
+
     popl::OptionParser m_parser;
 
     // Help message shows the available options as listed here (so, the order matters here).
@@ -204,7 +587,52 @@ private:
 
     std::shared_ptr<const popl::Switch> m_showAccounts;
     std::shared_ptr<const popl::Switch> m_signOut;
+    std::shared_ptr<const popl::Value<std::string>> m_mode;
+    std::shared_ptr<const popl::Value<int>> m_iterations;
+    std::shared_ptr<const popl::Switch> m_refreshAccounts;
+    std::shared_ptr<const popl::Switch> m_bindAccount;
+    std::shared_ptr<const popl::Switch> m_allAccounts;
+    std::shared_ptr<const popl::Value<std::string>> m_accountFilter;
+    std::shared_ptr<const popl::Value<int>> m_concurrency;
+    std::shared_ptr<const popl::Value<int>> m_cacheThreshold;
+    std::shared_ptr<const popl::Value<std::string>> m_requestFile;
+    std::shared_ptr<const popl::Switch> m_bench;
+    std::shared_ptr<const popl::Value<std::string>> m_baseline;
+    std::shared_ptr<const popl::Switch> m_saveBaseline;
+    std::shared_ptr<const popl::Value<double>> m_benchThreshold;
+    std::shared_ptr<const popl::Value<std::string>> m_synthetic;
+    std::shared_ptr<const popl::Switch> m_serve;
+    std::shared_ptr<const popl::Switch> m_client;
+    std::shared_ptr<const popl::Value<std::string>> m_pipe;
+    std::shared_ptr<const popl::Value<std::string>> m_output;
+    std::shared_ptr<const popl::Value<std::string>> m_redact;
+    std::shared_ptr<const popl::Value<std::string>> m_allowProperty;
+    std::shared_ptr<const popl::Value<int>> m_timeout;
+    std::shared_ptr<const popl::Value<int>> m_retries;
     std::shared_ptr<const popl::Value<std::string>> m_tracePath;
     std::shared_ptr<const popl::Switch> m_notrace;
+    std::shared_ptr<const popl::Switch> m_etw;
+    std::shared_ptr<const popl::Value<std::string>> m_traceFormat;
+    std::shared_ptr<const popl::Value<std::string>> m_convert;
+    std::shared_ptr<const popl::Value<int>> m_traceBuffer;
+    std::shared_ptr<const popl::Value<std::string>> m_traceOverflow;
+    std::shared_ptr<const popl::Value<int>> m_traceFlush;
+    std::shared_ptr<const popl::Value<int>> m_traceMaxSize;
+    std::shared_ptr<const popl::Value<int>> m_traceFiles;
+    std::shared_ptr<const popl::Value<int>> m_counters;
+    std::shared_ptr<const popl::Switch> m_counterBroker;
+    std::shared_ptr<const popl::Value<std::string>> m_chromeTrace;
+    std::shared_ptr<const popl::Value<std::string>> m_logLevel;
     std::shared_ptr<const popl::Switch> m_wait;
+
+    // Set by UpdateValues()
+    std::optional<winrt::hstring> m_clientIdValue;
+    std::optional<winrt::hstring> m_scopesValue;
+    std::vector<winrt::hstring> m_scopeSetsValue;
+    std::unordered_map<winrt::hstring, winrt::hstring> m_propertiesValue;
+    std::optional<winrt::hstring> m_loginHintValue;
+    std::optional<winrt::hstring> m_accountFilterValue;
+    std::optional<std::filesystem::path> m_baselineValue;
+    std::optional<std::filesystem::path> m_tracePathValue;
+    std::optional<std::filesystem::path> m_chromeTraceValue;
 };
\ No newline at end of file
@@ -17,14 +17,20 @@
 #include <security.h>
 
 #include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <coroutine>
 #include <cstdlib>
+#include <exception>
 #include <expected>
 #include <filesystem>
 #include <format>
 #include <iostream>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <print>
@@ -32,5 +38,6 @@
 #include <string_view>
 #include <system_error>
 #include <utility>
+#include <vector>
 
 #include "popl.hpp"
\ No newline at end of file
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sddl.h>
+
+#include "util.h"
+
+namespace Pipe
+{
+    inline constexpr auto DefaultName = L"GetToken";
+
+    // Requests are a single line, so anything longer is not a valid request
+    inline constexpr std::size_t MaxRequestSize = 64 * 1024;
+
+    // A client that connects must send its request line within this time
+    inline constexpr auto RequestTimeout = std::chrono::milliseconds{ 10'000 };
+
+    inline std::wstring GetPipePath(std::wstring_view name)
+    {
+        return std::wstring{ LR"(\\.\pipe\)" }.append(name);
+    }
+
+    namespace detail
+    {
+        /// <summary>
+        /// An OVERLAPPED with its own manual-reset event
+        /// </summary>
+        struct Overlapped
+        {
+            Overlapped() : Event{ ::CreateEventW(nullptr, TRUE, FALSE, nullptr) }
+            {
+                winrt::check_bool(static_cast<bool>(Event));
+                Value.hEvent = Event.get();
+            }
+
+            OVERLAPPED Value{};
+            winrt::handle Event;
+        };
+
+        /// <summary>
+        /// Complete an I/O call that returned FALSE: wait for it, the stop event or the timeout, whichever comes first.
+        /// A stopped or timed-out call is cancelled, and waited for, because it refers to the caller's OVERLAPPED & buffer.
+        /// </summary>
+        /// <param name="stop">Manual-reset event, or nullptr</param>
+        /// <returns>Bytes transferred, or the Win32 error (ERROR_OPERATION_ABORTED when stopped, ERROR_TIMEOUT when timed out)</returns>
+        inline std::expected<DWORD, DWORD> CompleteIo(HANDLE pipe, Overlapped& overlapped, HANDLE stop, DWORD timeout) noexcept
+        {
+            if (const auto error = ::GetLastError(); error != ERROR_IO_PENDING)
+            {
+                return std::unexpected{ error };
+            }
+
+            const HANDLE handles[] = { overlapped.Event.get(), stop };
+            const auto wait = ::WaitForMultipleObjects(stop ? 2 : 1, handles, FALSE, timeout);
+
+            if (wait != WAIT_OBJECT_0)
+            {
+                ::CancelIoEx(pipe, &overlapped.Value);
+            }
+
+            auto transferred = DWORD{};
+
+            if (not ::GetOverlappedResult(pipe, &overlapped.Value, &transferred, TRUE))
+            {
+                const auto error = ::GetLastError();
+
+                if (error == ERROR_OPERATION_ABORTED && wait == WAIT_TIMEOUT)
+                {
+                    return std::unexpected{ DWORD{ ERROR_TIMEOUT } };
+                }
+
+                return std::unexpected{ error };
+            }
+
+            return transferred;
+        }
+
+        inline DWORD ToTimeout(std::chrono::milliseconds timeout) noexcept
+        {
+            return timeout.count() <= 0 ? 0 : timeout.count() >= INFINITE ? INFINITE - 1 : static_cast<DWORD>(timeout.count());
+        }
+
+        struct LocalFreeDeleter
+        {
+            void operator()(void* p) const noexcept
+            {
+                ::LocalFree(p);
+            }
+        };
+
+        using SecurityDescriptor = std::unique_ptr<void, LocalFreeDeleter>;
+
+        /// <summary>
+        /// A security descriptor whose DACL grants access to the current user only, so that no other account can connect
+        /// to the server (its replies carry token results). Throws on failure.
+        /// </summary>
+        inline SecurityDescriptor GetCurrentUserOnlySecurity()
+        {
+            auto token = winrt::handle{};
+            winrt::check_bool(::OpenProcessToken(::GetCurrentProcess(), TOKEN_QUERY, token.put()));
+
+            auto size = DWORD{};
+            ::GetTokenInformation(token.get(), TokenUser, nullptr, 0, &size);
+
+            auto buffer = std::vector<std::byte>(size);
+            winrt::check_bool(::GetTokenInformation(token.get(), TokenUser, buffer.data(), size, &size));
+
+            auto sid = LPWSTR{};
+            winrt::check_bool(::ConvertSidToStringSidW(reinterpret_cast<const TOKEN_USER*>(buffer.data())->User.Sid, &sid));
+            const auto sidText = std::unique_ptr<wchar_t, LocalFreeDeleter>{ sid };
+
+            // Protected DACL with a single entry: generic all for the user
+            const auto sddl = std::format(L"D:P(A;;GA;;;{})", sidText.get());
+            auto descriptor = PSECURITY_DESCRIPTOR{};
+            winrt::check_bool(::ConvertStringSecurityDescriptorToSecurityDescriptorW(sddl.c_str(), SDDL_REVISION_1, &descriptor, nullptr));
+
+            return SecurityDescriptor{ descriptor };
+        }
+    }
+
+    /// <summary>
+    /// Read up to (and including) the first '\n' from a pipe opened with FILE_FLAG_OVERLAPPED.
+    /// Gives up when the stop event is set or the line has not arrived within the timeout, so a client that connects and
+    /// sends nothing cannot hold the thread.
+    /// </summary>
+    /// <param name="stop">Manual-reset event that cancels the read (e.g. Server::StopEvent()), or nullptr</param>
+    /// <returns>nullopt if the pipe is closed, stopped or timed out before a full line arrives, or the line is longer than maxSize</returns>
+    inline std::optional<std::string> ReadLine(HANDLE pipe, HANDLE stop, std::chrono::milliseconds timeout = RequestTimeout, std::size_t maxSize = MaxRequestSize)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        auto overlapped = detail::Overlapped{};
+        auto line = std::string{};
+        char buffer[4096];
+
+        while (line.size() < maxSize)
+        {
+            auto read = DWORD{};
+
+            if (not ::ReadFile(pipe, buffer, sizeof(buffer), &read, &overlapped.Value))
+            {
+                const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                const auto result = detail::CompleteIo(pipe, overlapped, stop, detail::ToTimeout(remaining));
+
+                if (not result)
+                {
+                    return std::nullopt;
+                }
+
+                read = *result;
+            }
+
+            if (read == 0)
+            {
+                return std::nullopt;
+            }
+
+            line.append(buffer, read);
+
+            if (line.find('\n') != std::string::npos)
+            {
+                return line;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    /// <summary>
+    /// Write all bytes to a pipe, opened with or without FILE_FLAG_OVERLAPPED. Throws on failure (e.g. the other end
+    /// disconnected), when the stop event is set, or when a write does not complete within the timeout.
+    /// </summary>
+    inline void WriteAll(HANDLE pipe, std::string_view data, HANDLE stop = nullptr, std::chrono::milliseconds timeout = RequestTimeout)
+    {
+        auto overlapped = detail::Overlapped{};
+
+        while (not data.empty())
+        {
+            auto written = DWORD{};
+
+            if (not ::WriteFile(pipe, data.data(), static_cast<DWORD>(data.size()), &written, &overlapped.Value))
+            {
+                const auto result = detail::CompleteIo(pipe, overlapped, stop, detail::ToTimeout(timeout));
+
+                if (not result)
+                {
+                    winrt::throw_hresult(HRESULT_FROM_WIN32(result.error()));
+                }
+
+                written = *result;
+            }
+
+            data.remove_prefix(written);
+        }
+    }
+
+    /// <summary>
+    /// Connect to a server, waiting for a free pipe instance if all are busy.
+    /// </summary>
+    inline winrt::file_handle Connect(const std::wstring& path, std::chrono::milliseconds timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+        while (true)
+        {
+            auto pipe = winrt::file_handle{ ::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr) };
+
+            if (pipe)
+            {
+                return pipe;
+            }
+
+            const auto error = ::GetLastError();
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+            if (error != ERROR_PIPE_BUSY || remaining.count() <= 0 || not ::WaitNamedPipeW(path.c_str(), static_cast<DWORD>(remaining.count())))
+            {
+                winrt::throw_hresult(HRESULT_FROM_WIN32(error == ERROR_PIPE_BUSY ? ERROR_SEM_TIMEOUT : error));
+            }
+        }
+    }
+
+    /// <summary>
+    /// Accepts clients on a named pipe, one pipe instance per client.
+    /// Accept() blocks, so call it on a background thread. Stop() (also called on Ctrl+C / Ctrl+Break) makes it return.
+    /// The pipe is open to the current user only, and the first instance is created with FILE_FLAG_FIRST_PIPE_INSTANCE, so
+    /// Accept() fails if another process already owns the name. A listening instance is kept at all times, so that the name
+    /// cannot be taken over between two clients.
+    /// </summary>
+    class Server final
+    {
+    public:
+        explicit Server(std::wstring path) :
+            _path{ std::move(path) },
+            _security{ detail::GetCurrentUserOnlySecurity() },
+            _stopEvent{ ::CreateEventW(nullptr, TRUE, FALSE, nullptr) }
+        {
+            winrt::check_bool(static_cast<bool>(_stopEvent));
+            _ctrlTarget.store(this);
+            ::SetConsoleCtrlHandler(OnConsoleCtrl, TRUE);
+        }
+
+        ~Server()
+        {
+            ::SetConsoleCtrlHandler(OnConsoleCtrl, FALSE);
+            _ctrlTarget.store(nullptr);
+        }
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        const std::wstring& Path() const noexcept
+        {
+            return _path;
+        }
+
+        bool Stopping() const noexcept
+        {
+            return _stopping.load();
+        }
+
+        /// <summary>
+        /// Manual-reset event set by Stop(). Pass it to ReadLine & WriteAll so that pending client I/O ends on stop.
+        /// </summary>
+        HANDLE StopEvent() const noexcept
+        {
+            return _stopEvent.get();
+        }
+
+        /// <summary>
+        /// Wait for the next client. The returned pipe is opened with FILE_FLAG_OVERLAPPED.
+        /// </summary>
+        /// <returns>The connected pipe, or an empty handle once Stop() is called</returns>
+        winrt::file_handle Accept()
+        {
+            if (not _listening)
+            {
+                _listening = CreateInstance(true);
+            }
+
+            while (not Stopping())
+            {
+                auto overlapped = detail::Overlapped{};
+
+                if (not ::ConnectNamedPipe(_listening.get(), &overlapped.Value))
+                {
+                    if (::GetLastError() != ERROR_PIPE_CONNECTED)
+                    {
+                        const auto result = detail::CompleteIo(_listening.get(), overlapped, _stopEvent.get(), INFINITE);
+
+                        if (not result)
+                        {
+                            if (Stopping())
+                            {
+                                break;
+                            }
+
+                            // The client went away before it was accepted. Use a new instance
+                            _listening = CreateInstance(false);
+                            continue;
+                        }
+                    }
+                }
+
+                if (Stopping())
+                {
+                    break;
+                }
+
+                // Listen on the next instance before handing out this one, so the name is never without an owner
+                auto pipe = std::exchange(_listening, CreateInstance(false));
+                return pipe;
+            }
+
+            _listening.close();
+            return {};
+        }
+
+        /// <summary>
+        /// Make Accept() return, and the reads & writes waiting on StopEvent() give up.
+        /// </summary>
+        void Stop() noexcept
+        {
+            if (_stopping.exchange(true))
+            {
+                return;
+            }
+
+            ::SetEvent(_stopEvent.get());
+        }
+
+    private:
+        static constexpr DWORD BufferSize = 64 * 1024;
+
+        winrt::file_handle CreateInstance(bool first)
+        {
+            auto attributes = SECURITY_ATTRIBUTES{ .nLength = sizeof(SECURITY_ATTRIBUTES), .lpSecurityDescriptor = _security.get(), .bInheritHandle = FALSE };
+
+            // PIPE_REJECT_REMOTE_CLIENTS: tokens must not leave the machine
+            auto pipe = winrt::file_handle{ ::CreateNamedPipeW(
+                _path.c_str(),
+                PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                PIPE_UNLIMITED_INSTANCES,
+                BufferSize,
+                BufferSize,
+                0,
+                &attributes) };
+
+            if (not pipe)
+            {
+                const auto error = ::GetLastError();
+
+                if (first && error == ERROR_ACCESS_DENIED)
+                {
+                    throw winrt::hresult_error{ HRESULT_FROM_WIN32(error), winrt::hstring{ std::format(L"{} is already in use by another process", _path) } };
+                }
+
+                winrt::throw_hresult(HRESULT_FROM_WIN32(error));
+            }
+
+            return pipe;
+        }
+
+        // Console control handlers are plain functions, so they reach the server through this
+        static inline std::atomic<Server*> _ctrlTarget{ nullptr };
+
+        static BOOL WINAPI OnConsoleCtrl(DWORD ctrlType) noexcept
+        {
+            if (ctrlType != CTRL_C_EVENT && ctrlType != CTRL_BREAK_EVENT)
+            {
+                return FALSE;
+            }
+
+            if (auto server = _ctrlTarget.load())
+            {
+                server->Stop();
+                return TRUE;
+            }
+
+            return FALSE;
+        }
+
+        const std::wstring _path;
+        const detail::SecurityDescriptor _security;
+        winrt::handle _stopEvent;
+        winrt::file_handle _listening;  // Used by Accept() only
+        std::atomic<bool> _stopping{ false };
+    };
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util.h"
+
+namespace Redact
+{
+    enum class Mode
+    {
+        None,       // Print values as they are
+        Truncate,   // Keep the first MaxLength characters
+        Hash        // Replace with a hash, so equal values can still be matched up
+    };
+
+    // Small, non-secret response properties that are always printed in full
+    inline constexpr std::wstring_view DefaultAllowList[] = {
+        L"Authority", L"TenantId", L"UPN", L"DisplayName", L"TokenExpiresOn", L"wamcompat_scopes"
+    };
+
+    struct Policy
+    {
+        Mode Redaction = Mode::Truncate;
+
+        // Values up to this length are printed in full
+        std::size_t MaxLength = 32;
+
+        // Extra property names to print in full, on top of DefaultAllowList
+        std::vector<std::wstring> AllowList;
+    };
+
+    inline std::optional<Mode> ParseMode(std::string_view value) noexcept
+    {
+        if (Util::EqualsIgnoreCase(value, "none"))
+        {
+            return Mode::None;
+        }
+
+        if (Util::EqualsIgnoreCase(value, "truncate"))
+        {
+            return Mode::Truncate;
+        }
+
+        if (Util::EqualsIgnoreCase(value, "hash"))
+        {
+            return Mode::Hash;
+        }
+
+        return std::nullopt;
+    }
+
+    namespace detail
+    {
+        // Set once at startup, before any value is printed, so reads need no synchronization
+        inline auto _policy = Policy{};
+
+        inline bool EqualsIgnoreCase(std::wstring_view a, std::wstring_view b) noexcept
+        {
+            return ::CompareStringOrdinal(a.data(), static_cast<int>(a.size()), b.data(), static_cast<int>(b.size()), TRUE) == CSTR_EQUAL;
+        }
+
+        /// <summary>
+        /// 64-bit FNV-1a. Not a cryptographic hash, but tokens are long random strings, so 64 bits of it reveal nothing useful
+        /// while still telling whether two outputs carry the same token. Cheap enough to run on every value.
+        /// </summary>
+        inline std::uint64_t Fnv1a(std::wstring_view value) noexcept
+        {
+            auto hash = std::uint64_t{ 14695981039346656037ull };
+
+            for (const auto c : value)
+            {
+                hash = (hash ^ static_cast<std::uint16_t>(c)) * 1099511628211ull;
+            }
+
+            return hash;
+        }
+    }
+
+    /// <summary>
+    /// Set the policy used by Apply(key, value, scratch). Call before any output is written.
+    /// </summary>
+    inline void SetPolicy(Policy policy)
+    {
+        detail::_policy = std::move(policy);
+    }
+
+    inline const Policy& GetPolicy() noexcept
+    {
+        return detail::_policy;
+    }
+
+    inline bool IsAllowed(const Policy& policy, std::wstring_view key) noexcept
+    {
+        for (const auto name : DefaultAllowList)
+        {
+            if (detail::EqualsIgnoreCase(name, key))
+            {
+                return true;
+            }
+        }
+
+        for (const auto& name : policy.AllowList)
+        {
+            if (detail::EqualsIgnoreCase(name, key))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /// <summary>
+    /// Redact a property value for output. Works on the UTF-16 value, so a long token is cut down before it is converted
+    /// to UTF-8 or formatted into a log line.
+    /// </summary>
+    /// <param name="scratch">Holds a hashed value. The returned view may point into it</param>
+    /// <returns>The value to print: the original, a prefix of it, or a hash in scratch</returns>
+    inline std::wstring_view Apply(const Policy& policy, std::wstring_view key, std::wstring_view value, std::wstring& scratch)
+    {
+        if (policy.Redaction == Mode::None || value.size() <= policy.MaxLength || IsAllowed(policy, key))
+        {
+            return value;
+        }
+
+        scratch.clear();
+
+        if (policy.Redaction == Mode::Truncate)
+        {
+            // Do not cut a surrogate pair in half, which would come out as U+FFFD in UTF-8
+            auto length = policy.MaxLength;
+
+            if (length > 0 && value[length - 1] >= 0xD800 && value[length - 1] <= 0xDBFF)
+            {
+                --length;
+            }
+
+            std::format_to(std::back_inserter(scratch), L"{}...({} chars)", value.substr(0, length), value.size());
+        }
+        else
+        {
+            std::format_to(std::back_inserter(scratch), L"fnv1a:{:016x} ({} chars)", detail::Fnv1a(value), value.size());
+        }
+
+        return scratch;
+    }
+
+    /// <summary>
+    /// Same as above, with the policy set by SetPolicy()
+    /// </summary>
+    inline std::wstring_view Apply(std::wstring_view key, std::wstring_view value, std::wstring& scratch)
+    {
+        return Apply(GetPolicy(), key, value, scratch);
+    }
+}
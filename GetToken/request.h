@@ -0,0 +1,274 @@
+#pragma once
+
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "util.h"
+
+namespace WAM
+{
+    /// <summary>
+    /// Parameters of one token request, independent of the command line.
+    /// On the wire it is a single line of tab separated "key=value" fields (scopes contain spaces, so tabs are used).
+    /// "clientid", "scopes" & "interactive" are request parameters; any other key is added as a request property.
+    /// e.g. "scopes=https://graph.microsoft.com/.default\tlogin_hint=user01@example.com"
+    /// </summary>
+    struct RequestSpec
+    {
+        std::optional<winrt::hstring> ClientId;
+        std::optional<winrt::hstring> Scopes;
+        bool Interactive = false;
+        std::unordered_map<winrt::hstring, winrt::hstring> Properties;
+
+        std::optional<winrt::hstring> LoginHint() const
+        {
+            if (auto it = Properties.find(L"login_hint"); it != Properties.end())
+            {
+                return it->second;
+            }
+
+            return std::nullopt;
+        }
+    };
+
+    /// <summary>
+    /// Parse a request line. A trailing "\r\n" or "\n" is ignored. An empty line is a request with default values.
+    /// </summary>
+    inline std::expected<RequestSpec, std::string> ParseRequestSpec(std::string_view line)
+    {
+        while (not line.empty() && (line.back() == '\n' || line.back() == '\r'))
+        {
+            line.remove_suffix(1);
+        }
+
+        auto spec = RequestSpec{};
+
+        while (not line.empty())
+        {
+            const auto end = line.find('\t');
+            const auto field = line.substr(0, end);
+            line = end == std::string_view::npos ? std::string_view{} : line.substr(end + 1);
+
+            if (field.empty())
+            {
+                continue;
+            }
+
+            const auto pos = field.find('=');
+
+            if (pos == std::string_view::npos || pos == 0)
+            {
+                return std::unexpected{ std::format("Invalid field '{}'. Fields must look like key=value", field) };
+            }
+
+            const auto key = field.substr(0, pos);
+            const auto value = field.substr(pos + 1);
+
+            if (Util::EqualsIgnoreCase(key, "clientid"))
+            {
+                spec.ClientId = winrt::to_hstring(value);
+            }
+            else if (Util::EqualsIgnoreCase(key, "scopes"))
+            {
+                spec.Scopes = winrt::to_hstring(value);
+            }
+            else if (Util::EqualsIgnoreCase(key, "interactive"))
+            {
+                spec.Interactive = Util::EqualsIgnoreCase(value, "true") || value == "1";
+            }
+            else
+            {
+                spec.Properties.insert_or_assign(winrt::to_hstring(key), winrt::to_hstring(value));
+            }
+        }
+
+        return spec;
+    }
+
+    /// <summary>
+    /// Format a request line (including the trailing "\n") that ParseRequestSpec reads back.
+    /// </summary>
+    inline std::string FormatRequestSpec(const RequestSpec& spec)
+    {
+        auto line = std::string{};
+        auto append = [&line](std::string_view key, std::wstring_view value) {
+            if (not line.empty())
+            {
+                line.push_back('\t');
+            }
+
+            line.append(key).push_back('=');
+            Util::to_string(value, line);
+        };
+
+        if (spec.ClientId)
+        {
+            append("clientid", *spec.ClientId);
+        }
+
+        if (spec.Scopes)
+        {
+            append("scopes", *spec.Scopes);
+        }
+
+        if (spec.Interactive)
+        {
+            append("interactive", L"true");
+        }
+
+        for (const auto& [key, value] : spec.Properties)
+        {
+            append(Util::to_string(key), value);
+        }
+
+        line.push_back('\n');
+        return line;
+    }
+
+    /// <summary>
+    /// Reads request lines from a file or standard input, one chunk at a time, so memory stays the same however long the input is.
+    /// Blank lines and lines starting with '#' are skipped. Reads block, so call ReadLine() on a background thread.
+    /// Not thread-safe: callers sharing a reader serialize their calls.
+    /// </summary>
+    class RequestReader final
+    {
+    public:
+        static constexpr std::size_t ChunkSize = 64 * 1024;
+
+        // Same limit as a request sent over the pipe
+        static constexpr std::size_t MaxLineSize = 64 * 1024;
+
+        /// <param name="path">File to read, or "-" for standard input</param>
+        explicit RequestReader(const std::filesystem::path& path) : _buffer{ std::make_unique<char[]>(ChunkSize) }
+        {
+            if (path == L"-")
+            {
+                _handle = ::GetStdHandle(STD_INPUT_HANDLE);
+                return;
+            }
+
+            _file = winrt::file_handle{ ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr) };
+
+            if (not _file)
+            {
+                winrt::throw_last_error();
+            }
+
+            _handle = _file.get();
+        }
+
+        RequestReader(const RequestReader&) = delete;
+        RequestReader& operator=(const RequestReader&) = delete;
+
+        /// <summary>
+        /// Read the next request line (without the line break) into line, reusing its capacity.
+        /// Throws hresult_error if the input cannot be read or a line is longer than MaxLineSize.
+        /// </summary>
+        /// <param name="number">1-based line number in the input, for reporting</param>
+        /// <returns>false at the end of the input</returns>
+        bool ReadLine(std::string& line, std::size_t& number)
+        {
+            while (ReadRawLine(line))
+            {
+                // A UTF-8 BOM as written by some editors
+                if (_lineNumber == 1 && line.starts_with("\xEF\xBB\xBF"))
+                {
+                    line.erase(0, 3);
+                }
+
+                const auto first = line.find_first_not_of(" \t");
+
+                if (first != std::string::npos && line[first] != '#')
+                {
+                    number = _lineNumber;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+    private:
+        bool ReadRawLine(std::string& line)
+        {
+            line.clear();
+
+            while (true)
+            {
+                if (_begin == _end)
+                {
+                    if (_eof || not Fill())
+                    {
+                        if (line.empty())
+                        {
+                            return false;
+                        }
+
+                        // The last line has no line break
+                        ++_lineNumber;
+                        return true;
+                    }
+                }
+
+                const auto data = _buffer.get() + _begin;
+                const auto size = _end - _begin;
+                const auto newline = static_cast<const char*>(std::memchr(data, '\n', size));
+                const auto count = newline ? static_cast<std::size_t>(newline - data) : size;
+
+                if (line.size() + count > MaxLineSize)
+                {
+                    throw winrt::hresult_error{ HRESULT_FROM_WIN32(ERROR_INVALID_DATA), winrt::to_hstring(std::format("Line {} is longer than {} bytes", _lineNumber + 1, MaxLineSize)) };
+                }
+
+                line.append(data, count);
+                _begin += newline ? count + 1 : count;
+
+                if (newline)
+                {
+                    if (not line.empty() && line.back() == '\r')
+                    {
+                        line.pop_back();
+                    }
+
+                    ++_lineNumber;
+                    return true;
+                }
+            }
+        }
+
+        // Read the next chunk. Returns false at the end of the input
+        bool Fill()
+        {
+            auto read = DWORD{};
+
+            if (not ::ReadFile(_handle, _buffer.get(), static_cast<DWORD>(ChunkSize), &read, nullptr))
+            {
+                // The writing end of a pipe (e.g. "type requests.txt | GetToken.exe --requestfile -") was closed
+                if (const auto error = ::GetLastError(); error != ERROR_BROKEN_PIPE)
+                {
+                    winrt::throw_hresult(HRESULT_FROM_WIN32(error));
+                }
+            }
+
+            _begin = 0;
+            _end = read;
+            _eof = read == 0;
+            return not _eof;
+        }
+
+        winrt::file_handle _file;
+        HANDLE _handle = nullptr;
+        std::unique_ptr<char[]> _buffer;
+        std::size_t _begin = 0;
+        std::size_t _end = 0;
+        std::size_t _lineNumber = 0;
+        bool _eof = false;
+    };
+}
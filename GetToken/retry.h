@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "timing.h"
+#include "trace.h"
+#include "util.h"
+
+namespace Retry
+{
+    using Clock = Diagnostics::Timing::Clock;
+
+    enum class Outcome
+    {
+        Completed,  // The operation finished (its result may still be an error status)
+        TimedOut,   // Cancelled after Policy::Timeout
+        Failed      // Threw an hresult_error
+    };
+
+    inline constexpr std::string_view to_string(const Outcome outcome) noexcept
+    {
+        switch (outcome)
+        {
+        case Outcome::Completed: return "Completed";
+        case Outcome::TimedOut: return "TimedOut";
+        case Outcome::Failed: return "Failed";
+        }
+
+        return "Unknown";
+    }
+
+    struct Attempt
+    {
+        std::string_view Phase;
+        int Number = 1;         // 1-based
+        int Count = 1;          // Attempts allowed by the policy
+        Clock::duration Latency{};
+        Outcome Result = Outcome::Completed;
+        winrt::hresult Error{}; // Set when Result is Failed
+    };
+
+    struct Policy
+    {
+        // Cancel an attempt that takes longer than this. No timeout if not set
+        std::optional<std::chrono::milliseconds> Timeout;
+
+        // Attempts after the first one, after a timeout or an exception
+        int Retries = 0;
+
+        // The backoff before retry n is drawn from [ceiling / 2, ceiling], where ceiling = min(BaseDelay * 2^(n-1), MaxDelay)
+        std::chrono::milliseconds BaseDelay{ 200 };
+        std::chrono::milliseconds MaxDelay{ 5000 };
+
+        // Called after every attempt (e.g. to write a JSON Lines record), from whichever thread the attempt finished on
+        std::function<void(const Attempt&)> OnAttempt;
+
+        bool IsActive() const noexcept
+        {
+            return Timeout.has_value() || Retries > 0;
+        }
+    };
+
+    namespace detail
+    {
+        /// <summary>
+        /// Exponential backoff with "equal jitter", so that processes that failed together do not retry in lockstep
+        /// </summary>
+        inline std::chrono::milliseconds GetBackoff(const Policy& policy, const int retry)
+        {
+            thread_local auto engine = std::minstd_rand{ std::random_device{}() };
+
+            const auto exponent = std::clamp(retry - 1, 0, 20);
+            const auto ceiling = std::min(policy.BaseDelay * (std::int64_t{ 1 } << exponent), policy.MaxDelay).count();
+            auto distribution = std::uniform_int_distribution<std::int64_t>{ ceiling / 2, std::max<std::int64_t>(ceiling, 0) };
+
+            return std::chrono::milliseconds{ distribution(engine) };
+        }
+
+        inline void Record(const Policy& policy, const Attempt& attempt) noexcept
+        {
+            using Diagnostics::Trace::Level;
+
+            try
+            {
+                // e.g. "GetTokenSilentlyAsync:TimedOut", so the timing summary shows the latency of each outcome
+                Diagnostics::Timing::Record(std::format("{}:{}", attempt.Phase, to_string(attempt.Result)), attempt.Latency);
+
+                if (attempt.Result == Outcome::TimedOut)
+                {
+                    Diagnostics::Trace::Write<Level::Warning>("{} attempt {}/{} timed out after {:.3f} ms and was cancelled",
+                        attempt.Phase, attempt.Number, attempt.Count, std::chrono::duration<double, std::milli>{ attempt.Latency }.count());
+                }
+                else if (attempt.Result == Outcome::Failed)
+                {
+                    Diagnostics::Trace::Write<Level::Warning>("{} attempt {}/{} failed with {:#x} after {:.3f} ms",
+                        attempt.Phase, attempt.Number, attempt.Count, static_cast<std::uint32_t>(attempt.Error), std::chrono::duration<double, std::milli>{ attempt.Latency }.count());
+                }
+
+                if (policy.OnAttempt)
+                {
+                    policy.OnAttempt(attempt);
+                }
+            }
+            catch (...)
+            {
+                // Recording must not affect the operation
+            }
+        }
+    }
+
+    /// <summary>
+    /// Run the async operation returned by start() under the policy: an attempt that exceeds the timeout is cancelled,
+    /// and a timed-out or failed attempt is retried after a jittered exponential backoff.
+    /// With an inactive policy the operation is simply awaited, so there is no overhead by default.
+    /// </summary>
+    /// <param name="phase">Name for the trace & timing summary. Must outlive the operation (typically a string literal)</param>
+    /// <param name="start">Starts a new attempt, e.g. [&] { return WebAuthenticationCoreManager::GetTokenSilentlyAsync(request); }</param>
+    /// <returns>The result of the first attempt that completed. Throws the last error (or ERROR_TIMEOUT) when all attempts fail</returns>
+    template <typename TResult, typename F>
+    IAsyncOperation<TResult> RunAsync(const Policy policy, const std::string_view phase, F start)
+    {
+        if (not policy.IsActive())
+        {
+            co_return co_await start();
+        }
+
+        const auto attempts = policy.Retries + 1;
+        auto lastError = std::optional<winrt::hresult_error>{};
+
+        for (int number = 1; ; ++number)
+        {
+            auto attempt = Attempt{ .Phase = phase, .Number = number, .Count = attempts };
+            auto result = TResult{ nullptr };
+            const auto begin = Clock::now();
+
+            try
+            {
+                auto operation = start();
+
+                if (policy.Timeout)
+                {
+                    // Shared with the handler, which may run after this coroutine has moved on
+                    auto completed = std::make_shared<winrt::handle>(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+                    winrt::check_bool(static_cast<bool>(*completed));
+                    operation.Completed([completed](auto&&, auto&&) { ::SetEvent(completed->get()); });
+
+                    if (co_await winrt::resume_on_signal(completed->get(), *policy.Timeout))
+                    {
+                        result = operation.GetResults();
+                    }
+                    else
+                    {
+                        operation.Cancel();
+                        attempt.Result = Outcome::TimedOut;
+                    }
+                }
+                else
+                {
+                    result = co_await operation;
+                }
+            }
+            catch (const winrt::hresult_error& e)
+            {
+                attempt.Result = Outcome::Failed;
+                attempt.Error = e.code();
+                lastError = e;
+            }
+
+            attempt.Latency = Clock::now() - begin;
+            detail::Record(policy, attempt);
+
+            if (attempt.Result == Outcome::Completed)
+            {
+                co_return result;
+            }
+
+            if (number == attempts)
+            {
+                if (attempt.Result == Outcome::Failed)
+                {
+                    throw *lastError;
+                }
+
+                throw winrt::hresult_error{ HRESULT_FROM_WIN32(ERROR_TIMEOUT), winrt::to_hstring(std::format("{} timed out {} time(s) after {} ms", phase, attempts, policy.Timeout->count())) };
+            }
+
+            co_await winrt::resume_after(detail::GetBackoff(policy, number));
+        }
+    }
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Util
+{
+    /// <summary>
+    /// Fixed-capacity lock-free ring buffer of preallocated slots (bounded MPMC queue by Dmitry Vyukov).
+    /// Multiple producers & a single consumer are the intended use, but TryPop is safe to call from producers too
+    /// (e.g. a producer discarding the oldest element when the buffer is full).
+    /// Elements are written & read in place, so T's storage is reused for the lifetime of the buffer.
+    /// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+    /// </summary>
+    template <typename T>
+    class RingBuffer final
+    {
+    public:
+        /// <param name="capacity">Number of slots. Rounded up to a power of two.</param>
+        explicit RingBuffer(std::size_t capacity)
+            : _capacity{ std::bit_ceil(capacity < 2 ? std::size_t{ 2 } : capacity) },
+            _mask{ _capacity - 1 },
+            _slots{ std::make_unique<Slot[]>(_capacity) }
+        {
+            for (std::size_t i = 0; i < _capacity; ++i)
+            {
+                _slots[i].Sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+        /// <summary>
+        /// Reserve a slot and let "fill" write the element in place.
+        /// </summary>
+        /// <returns>false if the buffer is full</returns>
+        template <typename F>
+        bool TryPush(F&& fill)
+        {
+            auto pos = _enqueuePos.load(std::memory_order_relaxed);
+            Slot* slot = nullptr;
+
+            while (true)
+            {
+                slot = &_slots[pos & _mask];
+                const auto seq = slot->Sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+                if (diff == 0)
+                {
+                    if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = _enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            // Publish the slot even if "fill" throws; otherwise the consumer would be stuck at this slot.
+            struct Publish
+            {
+                Slot* slot;
+                std::size_t value;
+                ~Publish() { slot->Sequence.store(value, std::memory_order_release); }
+            } publish{ slot, pos + 1 };
+
+            fill(slot->Value);
+            return true;
+        }
+
+        /// <summary>
+        /// Take the oldest element and let "consume" read it in place.
+        /// </summary>
+        /// <returns>false if the buffer is empty</returns>
+        template <typename F>
+        bool TryPop(F&& consume)
+        {
+            auto pos = _dequeuePos.load(std::memory_order_relaxed);
+            Slot* slot = nullptr;
+
+            while (true)
+            {
+                slot = &_slots[pos & _mask];
+                const auto seq = slot->Sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+
+                if (diff == 0)
+                {
+                    if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = _dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            struct Release
+            {
+                RingBuffer* buffer;
+                Slot* slot;
+                std::size_t value;
+
+                ~Release()
+                {
+                    slot->Sequence.store(value, std::memory_order_release);
+                    buffer->NotifyPopped();
+                }
+            } release{ this, slot, pos + _mask + 1 };
+
+            consume(slot->Value);
+            return true;
+        }
+
+        /// <summary>
+        /// Check if there is no element ready to be consumed.
+        /// </summary>
+        bool Empty() const noexcept
+        {
+            const auto pos = _dequeuePos.load(std::memory_order_acquire);
+            const auto seq = _slots[pos & _mask].Sequence.load(std::memory_order_acquire);
+            return static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1) < 0;
+        }
+
+        std::size_t Capacity() const noexcept
+        {
+            return _capacity;
+        }
+
+        /// <summary>
+        /// Number of elements popped so far. Read it before a TryPush that may fail, and pass it to WaitForPop.
+        /// </summary>
+        std::size_t PopCount() const noexcept
+        {
+            return _popCount.load(std::memory_order_acquire);
+        }
+
+        /// <summary>
+        /// Block (without spinning) until an element is popped after PopCount() returned popCount, i.e. until a slot is free
+        /// </summary>
+        void WaitForPop(std::size_t popCount) noexcept
+        {
+            // The seq_cst pair with NotifyPopped: either the consumer sees the waiter, or the waiter sees the new count
+            _waiters.fetch_add(1, std::memory_order_seq_cst);
+            _popCount.wait(popCount, std::memory_order_seq_cst);
+            _waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+    private:
+        void NotifyPopped() noexcept
+        {
+            _popCount.fetch_add(1, std::memory_order_seq_cst);
+
+            // Most pops have no producer waiting, so skip the wake-up call
+            if (_waiters.load(std::memory_order_seq_cst) > 0)
+            {
+                _popCount.notify_all();
+            }
+        }
+
+        // Keep the producer & consumer indices on separate cache lines
+        static constexpr std::size_t CacheLineSize = 64;
+
+        struct Slot
+        {
+            std::atomic<std::size_t> Sequence;
+            T Value;
+        };
+
+        const std::size_t _capacity;
+        const std::size_t _mask;
+        const std::unique_ptr<Slot[]> _slots;
+
+        alignas(CacheLineSize) std::atomic<std::size_t> _enqueuePos{ 0 };
+        alignas(CacheLineSize) std::atomic<std::size_t> _dequeuePos{ 0 };
+
+        // Only touched by consumers, and by producers waiting for a free slot
+        alignas(CacheLineSize) std::atomic<std::size_t> _popCount{ 0 };
+        std::atomic<int> _waiters{ 0 };
+    };
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <vector>
+
+namespace Scheduler
+{
+    namespace detail
+    {
+        template <typename F>
+        IAsyncAction WorkerAsync(std::atomic<std::size_t>& next, const std::size_t count, std::atomic<bool>& stop, F& task, std::exception_ptr& error)
+        {
+            try
+            {
+                for (auto i = next.fetch_add(1); i < count && not stop; i = next.fetch_add(1))
+                {
+                    co_await task(i);
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+                stop = true;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Run task(i) for every i in [0, count) with at most maxInFlight tasks running at once, and complete when all are done.
+    /// Each of the maxInFlight workers starts the next task as soon as its previous one completes, so a slow task holds back
+    /// only its own worker and the number of broker calls in flight stays at the limit until the items run out.
+    /// </summary>
+    /// <param name="task">Returns an awaitable for item i, e.g. an IAsyncAction. Record errors in it: if it throws, no new tasks
+    /// are started and the first exception is rethrown once the running ones are done</param>
+    template <typename F>
+    IAsyncAction ForEachAsync(const std::size_t count, const std::size_t maxInFlight, F task)
+    {
+        const auto workerCount = std::clamp<std::size_t>(maxInFlight, 1, std::max<std::size_t>(count, 1));
+        auto next = std::atomic<std::size_t>{ 0 };
+        auto stop = std::atomic<bool>{ false };
+        auto errors = std::vector<std::exception_ptr>(workerCount);
+        auto workers = std::vector<IAsyncAction>{};
+        workers.reserve(workerCount);
+
+        for (std::size_t i = 0; i < workerCount; ++i)
+        {
+            workers.push_back(detail::WorkerAsync(next, count, stop, task, errors[i]));
+        }
+
+        // The workers refer to the state above, so all of them are awaited before an error is rethrown
+        for (const auto& worker : workers)
+        {
+            co_await worker;
+        }
+
+        for (const auto& error : errors)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+}
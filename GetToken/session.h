@@ -0,0 +1,146 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "retry.h"
+#include "timing.h"
+#include "util.h"
+#include "wam.h"
+#include "wamclient.h"
+
+namespace WAM
+{
+    /// <summary>
+    /// Caches the WebAccountProvider & the accounts found for each client ID, so that repeated token requests
+    /// do not pay for FindAccountProviderAsync & FindAllAccountsAsync every time.
+    /// The cache lives as long as the session. Call Invalidate() to look them up again.
+    /// The lookups (and the token requests of the callers) run under the session's retry policy, through its IWamClient.
+    /// Note: The session must outlive the async operations it returns.
+    /// </summary>
+    class Session final
+    {
+    public:
+        explicit Session(Retry::Policy policy = {}, std::shared_ptr<IWamClient> wam = std::make_shared<WamClient>()) :
+            _policy{ std::move(policy) },
+            _wam{ std::move(wam) }
+        {}
+
+        Session(const Session&) = delete;
+        Session& operator=(const Session&) = delete;
+
+        IAsyncOperation<WebAccountProvider> GetProviderAsync()
+        {
+            if (auto cached = CachedProvider())
+            {
+                co_return cached;
+            }
+
+            auto timer = Diagnostics::Timing::ScopedTimer{ "FindAccountProviderAsync" };
+            auto provider = co_await Retry::RunAsync<WebAccountProvider>(_policy, "FindAccountProviderAsync", [this] {
+                return _wam->FindAccountProviderAsync(ProviderId::MICROSOFT, Authority::ORGANIZATION);
+            });
+            timer.Stop();
+
+            // Do not cache a failure
+            if (provider)
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                _provider = provider;
+            }
+
+            co_return provider;
+        }
+
+        IAsyncOperation<FindAllAccountsResult> FindAllAccountsAsync(const WebAccountProvider provider, const winrt::hstring clientId)
+        {
+            if (auto cached = CachedAccounts(clientId))
+            {
+                co_return cached;
+            }
+
+            auto timer = Diagnostics::Timing::ScopedTimer{ "FindAllAccountsAsync" };
+            auto result = co_await Retry::RunAsync<FindAllAccountsResult>(_policy, "FindAllAccountsAsync", [&] {
+                return _wam->FindAllAccountsAsync(provider, clientId);
+            });
+            timer.Stop();
+
+            if (result.Status() == FindAllWebAccountsStatus::Success)
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                _accounts.insert_or_assign(clientId, result);
+            }
+
+            co_return result;
+        }
+
+        const Retry::Policy& RetryPolicy() const noexcept
+        {
+            return _policy;
+        }
+
+        IWamClient& Wam() const noexcept
+        {
+            return *_wam;
+        }
+
+        /// <summary>
+        /// Drop the cached provider & accounts (e.g. after signing out or with --refreshaccounts)
+        /// </summary>
+        void Invalidate()
+        {
+            auto lock = std::scoped_lock{ _mutex };
+            _provider = nullptr;
+            _accounts.clear();
+        }
+
+    private:
+        WebAccountProvider CachedProvider()
+        {
+            auto lock = std::scoped_lock{ _mutex };
+            return _provider;
+        }
+
+        FindAllAccountsResult CachedAccounts(const winrt::hstring& clientId)
+        {
+            auto lock = std::scoped_lock{ _mutex };
+
+            if (auto it = _accounts.find(clientId); it != _accounts.end())
+            {
+                return it->second;
+            }
+
+            return nullptr;
+        }
+
+        const Retry::Policy _policy;
+        const std::shared_ptr<IWamClient> _wam;
+        std::mutex _mutex;
+        WebAccountProvider _provider{ nullptr };
+        std::unordered_map<winrt::hstring, FindAllAccountsResult> _accounts;
+    };
+
+    /// <summary>
+    /// Pick the account whose UserName matches loginHint, or the first account if loginHint is not given.
+    /// </summary>
+    /// <returns>nullptr if there is no matching account</returns>
+    inline WebAccount SelectAccount(const FindAllAccountsResult& result, const std::optional<winrt::hstring>& loginHint)
+    {
+        if (not result || result.Status() != FindAllWebAccountsStatus::Success)
+        {
+            return nullptr;
+        }
+
+        for (const auto& account : result.Accounts())
+        {
+            if (not loginHint || ::CompareStringOrdinal(account.UserName().c_str(), -1, loginHint->c_str(), -1, TRUE) == CSTR_EQUAL)
+            {
+                return account;
+            }
+        }
+
+        return nullptr;
+    }
+}
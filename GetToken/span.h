@@ -0,0 +1,293 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#ifndef  NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <Windows.h>
+#include <combaseapi.h>
+
+#include <winrt/base.h>
+
+#include "json.h"
+#include "timing.h"
+#include "trace.h"
+#include "util.h"
+
+namespace Diagnostics::Spans
+{
+    using Clock = Timing::Clock;
+
+    /// <summary>
+    /// One WAM call of one token request, keyed by the request's CorrelationId
+    /// </summary>
+    struct Span
+    {
+        std::string_view Name;          // e.g. "GetTokenSilentlyAsync". A string literal
+        winrt::hstring CorrelationId;
+        Clock::time_point Start;
+        Clock::time_point End;
+        DWORD StartThreadId = 0;
+        DWORD EndThreadId = 0;          // Differs from StartThreadId when the call completes on another thread
+        int InFlight = 0;               // Spans running when this one started, including itself
+        int InFlightAtEnd = 0;          // Spans still running when this one ended
+        std::string_view Status;        // e.g. "Success", or "Exception" when the call threw. A string literal
+        std::uint32_t Error = 0;        // Provider error code, or the HRESULT of the exception
+    };
+
+    // Spans kept for the Chrome trace beyond this are counted but dropped, so that a long run cannot exhaust memory
+    inline constexpr std::size_t MaxExportedSpans = 1'000'000;
+
+    namespace detail
+    {
+        // Time zero of the exported timeline
+        inline const auto _origin = Clock::now();
+
+        inline auto _inFlight = std::atomic<int>{ 0 };
+        inline auto _exportEnabled = std::atomic<bool>{ false };
+        inline auto _mutex = std::mutex{};
+        inline auto _spans = std::vector<Span>{};
+        inline auto _dropped = std::size_t{ 0 };
+
+        /// <summary>
+        /// Write the span to the trace as phase "Span:<name>", and keep it for the Chrome trace if enabled
+        /// </summary>
+        inline void Record(const Span& span) noexcept
+        {
+            try
+            {
+                if (Trace::IsEnabled())
+                {
+                    // e.g. "correlationId=... status=Success error=0x0 startThread=1234 endThread=5678 inFlight=3"
+                    thread_local auto phase = std::string{};
+                    thread_local auto message = std::string{};
+                    phase.assign("Span:").append(span.Name);
+                    message.assign("correlationId=");
+                    Util::to_string(span.CorrelationId, message);
+                    std::format_to(std::back_inserter(message), " status={} error={:#x} startThread={} endThread={} inFlight={}",
+                        span.Status, span.Error, span.StartThreadId, span.EndThreadId, span.InFlight);
+
+                    Trace::WriteDuration(phase, span.End - span.Start, message);
+                }
+
+                if (_exportEnabled.load(std::memory_order_relaxed))
+                {
+                    auto lock = std::scoped_lock{ _mutex };
+
+                    if (_spans.size() < MaxExportedSpans)
+                    {
+                        _spans.push_back(span);
+                    }
+                    else
+                    {
+                        ++_dropped;
+                    }
+                }
+            }
+            catch (...)
+            {
+                // Tracing must not affect the request
+            }
+        }
+
+        inline double ToMicroseconds(Clock::time_point time) noexcept
+        {
+            return std::chrono::duration<double, std::micro>{ time - _origin }.count();
+        }
+    }
+
+    /// <summary>
+    /// A new CorrelationId (a GUID in the usual 8-4-4-4-12 form) for a request that has none, so that its span has a key
+    /// </summary>
+    inline winrt::hstring NewCorrelationId()
+    {
+        auto id = GUID{};
+        winrt::check_hresult(::CoCreateGuid(&id));
+
+        return winrt::hstring{ std::format(L"{:08x}-{:04x}-{:04x}-{:02x}{:02x}-{:02x}{:02x}{:02x}{:02x}{:02x}{:02x}",
+            id.Data1, id.Data2, id.Data3, id.Data4[0], id.Data4[1], id.Data4[2], id.Data4[3], id.Data4[4], id.Data4[5], id.Data4[6], id.Data4[7]) };
+    }
+
+    /// <summary>
+    /// Measure a WAM call from construction until End() is called or the span goes out of scope, and record it.
+    /// Note: name must outlive the span (typically a string literal).
+    /// </summary>
+    class ScopedSpan final
+    {
+    public:
+        [[nodiscard]] ScopedSpan(std::string_view name, winrt::hstring correlationId) noexcept
+        {
+            _span.Name = name;
+            _span.CorrelationId = std::move(correlationId);
+            _span.StartThreadId = ::GetCurrentThreadId();
+            _span.InFlight = detail::_inFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+            _span.Status = "Abandoned";
+            _span.Start = Clock::now();
+        }
+
+        ScopedSpan(const ScopedSpan&) = delete;
+        ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+        ~ScopedSpan()
+        {
+            End();
+        }
+
+        /// <summary>
+        /// Set the outcome reported when the span ends
+        /// </summary>
+        void SetResult(std::string_view status, std::uint32_t error) noexcept
+        {
+            _span.Status = status;
+            _span.Error = error;
+        }
+
+        void End() noexcept
+        {
+            if (not _ended)
+            {
+                _ended = true;
+                _span.End = Clock::now();
+                _span.EndThreadId = ::GetCurrentThreadId();
+                _span.InFlightAtEnd = detail::_inFlight.fetch_sub(1, std::memory_order_relaxed) - 1;
+                detail::Record(_span);
+            }
+        }
+
+    private:
+        Span _span;
+        bool _ended = false;
+    };
+
+    /// <summary>
+    /// Keep the spans from now on, for WriteChromeTrace(). Call at startup.
+    /// </summary>
+    inline void EnableExport() noexcept
+    {
+        detail::_exportEnabled = true;
+    }
+
+    /// <summary>
+    /// Write the kept spans as a Chrome trace (JSON object format), which Perfetto (ui.perfetto.dev) and chrome://tracing open.
+    /// Each span is a pair of async events ("b" & "e") with the CorrelationId as the id, so concurrent requests get tracks of their
+    /// own, and the "InFlight" counter shows how many calls overlapped at any time. The written spans are released, so call it once
+    /// at exit. Throws std::runtime_error on failure.
+    /// </summary>
+    /// <returns>The number of spans written</returns>
+    inline std::size_t WriteChromeTrace(const std::filesystem::path& path)
+    {
+        using detail::ToMicroseconds;
+
+        auto spans = std::vector<Span>{};
+        auto dropped = std::size_t{};
+
+        {
+            // Take the spans rather than copy them, so the export does not double the memory they use
+            auto lock = std::scoped_lock{ detail::_mutex };
+            spans = std::exchange(detail::_spans, {});
+            dropped = detail::_dropped;
+        }
+
+        auto file = std::ofstream{ path, std::ios::binary | std::ios::trunc };
+
+        if (not file)
+        {
+            throw std::runtime_error{ std::format("Failed to open {}", path.string()) };
+        }
+
+        // Each event is formatted into this buffer and written out, so the file is never held in memory
+        const auto pid = static_cast<std::int64_t>(::GetCurrentProcessId());
+        auto out = std::string{};
+        const auto flush = [&] {
+            file.write(out.data(), static_cast<std::streamsize>(out.size()));
+            out.clear();
+        };
+
+        out.append("{\"traceEvents\":[\n");
+
+        auto first = true;
+        const auto event = [&](auto&& fill) {
+            if (not first)
+            {
+                out.append(",\n");
+            }
+
+            first = false;
+            auto json = Json::Writer{ out };
+            json.BeginObject();
+            fill(json);
+            json.EndObject();
+            flush();
+        };
+
+        event([&](Json::Writer& json) {
+            json.Field("name", "process_name").Field("ph", "M").Field("pid", pid)
+                .Key("args").BeginObject().Field("name", Util::GetModulePath(nullptr).stem().string()).EndObject();
+        });
+
+        for (const auto& span : spans)
+        {
+            const auto start = ToMicroseconds(span.Start);
+            const auto end = ToMicroseconds(span.End);
+
+            event([&](Json::Writer& json) {
+                json.Field("name", span.Name).Field("cat", "WAM").Field("ph", "b").Field("id", span.CorrelationId)
+                    .Field("ts", start).Field("pid", pid).Field("tid", span.StartThreadId)
+                    .Key("args").BeginObject().Field("correlationId", span.CorrelationId).Field("inFlight", span.InFlight).EndObject();
+            });
+
+            event([&](Json::Writer& json) {
+                json.Field("name", span.Name).Field("cat", "WAM").Field("ph", "e").Field("id", span.CorrelationId)
+                    .Field("ts", end).Field("pid", pid).Field("tid", span.EndThreadId)
+                    .Key("args").BeginObject()
+                    .Field("status", span.Status)
+                    .Field("error", std::format("{:#x}", span.Error))
+                    .Field("durationMs", std::chrono::duration<double, std::milli>{ span.End - span.Start }.count())
+                    .EndObject();
+            });
+
+            for (const auto& [time, inFlight] : { std::pair{ start, span.InFlight }, std::pair{ end, span.InFlightAtEnd } })
+            {
+                event([&](Json::Writer& json) {
+                    json.Field("name", "InFlight").Field("ph", "C").Field("ts", time).Field("pid", pid)
+                        .Key("args").BeginObject().Field("requests", inFlight).EndObject();
+                });
+            }
+        }
+
+        out.append("\n],\"displayTimeUnit\":\"ms\"");
+
+        if (dropped > 0)
+        {
+            std::format_to(std::back_inserter(out), ",\"otherData\":{{\"droppedSpans\":{}}}", dropped);
+        }
+
+        out.append("}\n");
+        flush();
+
+        if (not file.flush())
+        {
+            throw std::runtime_error{ std::format("Failed to write the Chrome trace to {}", path.string()) };
+        }
+
+        return spans.size();
+    }
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "trace.h"
+
+namespace Diagnostics::Timing
+{
+    // steady_clock is backed by QueryPerformanceCounter on MSVC
+    using Clock = std::chrono::steady_clock;
+
+    struct PhaseStats
+    {
+        std::string Phase;
+        std::size_t Count = 0;
+        Clock::duration Total{};
+        Clock::duration Min = Clock::duration::max();
+        Clock::duration Max{};
+    };
+
+    namespace detail
+    {
+        /// <summary>
+        /// Accumulates durations per phase. Phases are kept in the order they are first seen.
+        /// </summary>
+        class Registry final
+        {
+        public:
+            void Add(std::string_view phase, Clock::duration duration)
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                auto it = std::ranges::find(_phases, phase, &PhaseStats::Phase);
+
+                if (it == _phases.end())
+                {
+                    it = _phases.insert(_phases.end(), PhaseStats{ .Phase = std::string{ phase } });
+                }
+
+                ++it->Count;
+                it->Total += duration;
+                it->Min = std::min(it->Min, duration);
+                it->Max = std::max(it->Max, duration);
+            }
+
+            std::vector<PhaseStats> GetStats() const
+            {
+                auto lock = std::scoped_lock{ _mutex };
+                return _phases;
+            }
+
+        private:
+            mutable std::mutex _mutex;
+            std::vector<PhaseStats> _phases;
+        };
+
+        inline auto _registry = Registry{};
+    }
+
+    /// <summary>
+    /// Record a duration measured elsewhere (e.g. one attempt of a retried call).
+    /// The duration is written to the trace and added to the summary.
+    /// </summary>
+    inline void Record(std::string_view phase, Clock::duration duration)
+    {
+        detail::_registry.Add(phase, duration);
+        Trace::WriteDuration(phase, duration);
+    }
+
+    /// <summary>
+    /// Measure the time until Stop() is called or the timer goes out of scope.
+    /// The duration is written to the trace and added to the summary.
+    /// Note: phase must outlive the timer (typically a string literal).
+    /// </summary>
+    class ScopedTimer final
+    {
+    public:
+        [[nodiscard]] explicit ScopedTimer(std::string_view phase) noexcept
+            : _phase{ phase }, _start{ Clock::now() }
+        {}
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+        ~ScopedTimer()
+        {
+            Stop();
+        }
+
+        /// <summary>
+        /// Stop the timer and record the duration. Subsequent calls return the same duration.
+        /// </summary>
+        Clock::duration Stop() noexcept
+        {
+            if (not _stopped)
+            {
+                _duration = Clock::now() - _start;
+                _stopped = true;
+
+                try
+                {
+                    Record(_phase, _duration);
+                }
+                catch (...)
+                {
+                    // Timing must not affect the measured operation
+                }
+            }
+
+            return _duration;
+        }
+
+    private:
+        std::string_view _phase;
+        Clock::time_point _start;
+        Clock::duration _duration{};
+        bool _stopped = false;
+    };
+
+    inline std::vector<PhaseStats> GetStats()
+    {
+        return detail::_registry.GetStats();
+    }
+}
@@ -2,12 +2,31 @@
 #ifndef TRACE_HPP
 #define TRACE_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <fstream>
 #include <future>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <print>
 #include <ranges>
 #include <semaphore>
+#include <span>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -18,81 +37,680 @@
 #endif
 
 #include <Windows.h>
-#include <agents.h>
 
+#include "mappedfile.h"
+#include "ringbuffer.h"
 #include "util.h"
 
+// Messages above this level are compiled out (e.g. define TRACE_MAX_LEVEL=Info for a build without verbose & debug lines)
+#ifndef TRACE_MAX_LEVEL
+#define TRACE_MAX_LEVEL Debug
+#endif
+
+namespace Diagnostics::Trace
+{
+    /// <summary>
+    /// Severity of a message. A message is written when its level is at or below both MaxLevel and the runtime level.
+    /// </summary>
+    enum class Level
+    {
+        Error,
+        Warning,
+        Info,
+        Verbose,
+        Debug,
+    };
+
+    inline constexpr auto MaxLevel = Level::TRACE_MAX_LEVEL;
+
+    namespace detail
+    {
+        inline auto _level = std::atomic<Level>{ Level::Verbose };
+
+        // Per-thread buffer that Write() & WriteDuration() format into, so that formatting does not allocate once it has grown
+        inline std::string& MessageBuffer() noexcept
+        {
+            thread_local auto buffer = std::string{};
+            return buffer;
+        }
+    }
+
+    inline void SetLevel(Level level) noexcept
+    {
+        detail::_level.store(level, std::memory_order_relaxed);
+    }
+
+    inline Level GetLevel() noexcept
+    {
+        return detail::_level.load(std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Check if messages of the given level should be written. This is a single branch (or a constant false above MaxLevel).
+    /// </summary>
+    template <Level level>
+    inline bool IsLevelEnabled() noexcept
+    {
+        if constexpr (level > MaxLevel)
+        {
+            return false;
+        }
+        else
+        {
+            return level <= detail::_level.load(std::memory_order_relaxed);
+        }
+    }
+
+    inline std::optional<Level> ParseLevel(std::string_view value) noexcept
+    {
+        constexpr auto names = std::array{
+            std::pair{ std::string_view{ "error" }, Level::Error },
+            std::pair{ std::string_view{ "warning" }, Level::Warning },
+            std::pair{ std::string_view{ "info" }, Level::Info },
+            std::pair{ std::string_view{ "verbose" }, Level::Verbose },
+            std::pair{ std::string_view{ "debug" }, Level::Debug },
+        };
+
+        for (const auto& [name, level] : names)
+        {
+            if (Util::EqualsIgnoreCase(value, name))
+            {
+                return level;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    /// <summary>
+    /// What a writer does when the trace buffer is full
+    /// </summary>
+    enum class OverflowPolicy
+    {
+        Block,        // Wait until the consumer frees a slot (no message is lost)
+        DropOldest,   // Discard the oldest buffered message to make room
+        CountDropped, // Discard the new message
+    };
+
+    enum class TraceFormat
+    {
+        Csv,
+        Binary, // Compact records. Use ConvertToCsv() to read them.
+    };
+
+    struct TraceOptions
+    {
+        TraceFormat Format = TraceFormat::Csv;
+
+        // Number of preallocated slots in the trace buffer
+        std::size_t BufferSize = 4096;
+        OverflowPolicy Overflow = OverflowPolicy::Block;
+
+        // How often buffered messages are written to the file. Zero writes as soon as messages arrive.
+        std::chrono::milliseconds FlushInterval{ 0 };
+
+        // Bytes per file. When a file is full, the trace moves on to a new one and keeps the newest MaxFiles files.
+        // Zero writes a single file that grows without limit.
+        std::size_t MaxFileSize = 0;
+        std::size_t MaxFiles = 10;
+    };
+
+    inline std::optional<OverflowPolicy> ParseOverflowPolicy(std::string_view value) noexcept
+    {
+        auto equals = [value](std::string_view name) { return Util::EqualsIgnoreCase(value, name); };
+
+        if (equals("block"))
+        {
+            return OverflowPolicy::Block;
+        }
+        else if (equals("drop-oldest"))
+        {
+            return OverflowPolicy::DropOldest;
+        }
+        else if (equals("count-dropped"))
+        {
+            return OverflowPolicy::CountDropped;
+        }
+
+        return std::nullopt;
+    }
+
+    inline std::optional<TraceFormat> ParseTraceFormat(std::string_view value) noexcept
+    {
+        auto equals = [value](std::string_view name) { return Util::EqualsIgnoreCase(value, name); };
+
+        if (equals("csv"))
+        {
+            return TraceFormat::Csv;
+        }
+        else if (equals("binary"))
+        {
+            return TraceFormat::Binary;
+        }
+
+        return std::nullopt;
+    }
+}
+
 namespace Diagnostics::Trace::detail
 {
+    /// <summary>
+    /// Format a time point as "{0:%F}T{0:%T%z}".
+    /// The part up to seconds is cached, so only the fraction is formatted for messages within the same second.
+    /// </summary>
+    class TimestampFormatter final
+    {
+    public:
+        template <typename Out>
+        Out Format(Out out, const std::chrono::system_clock::time_point time)
+        {
+            using namespace std::chrono;
+
+            const auto second = floor<seconds>(time);
+
+            if (second != _cachedSecond || _cached.empty())
+            {
+                // e.g. "2024-01-23T12:34:56+0000"
+                _cached = std::format("{0:%F}T{0:%T%z}", second);
+                _cachedSecond = second;
+            }
+
+            constexpr auto FractionalWidth = hh_mm_ss<system_clock::duration>::fractional_width;
+            constexpr auto SecondsLength = std::string_view{ "YYYY-MM-DDTHH:MM:SS" }.size();
+
+            const auto prefix = std::string_view{ _cached }.substr(0, SecondsLength);
+            const auto zone = std::string_view{ _cached }.substr(SecondsLength);
+
+            if constexpr (FractionalWidth > 0)
+            {
+                return std::format_to(out, "{}.{:0{}}{}", prefix, (time - second).count(), FractionalWidth, zone);
+            }
+            else
+            {
+                return std::format_to(out, "{}{}", prefix, zone);
+            }
+        }
+
+    private:
+        std::chrono::sys_seconds _cachedSecond{};
+        std::string _cached;
+    };
+
     class ITracer
     {
     public:
         virtual ~ITracer() = default;
         virtual void Write(std::string_view) = 0;
+
+        // Write a message with a phase name & its duration as separate columns
+        virtual void Write(std::string_view phase, std::chrono::nanoseconds duration, std::string_view message) = 0;
+
+        // Write a message of the given level. Sinks that record the level override this; the others drop it.
+        virtual void Write(Level /*level*/, std::string_view message)
+        {
+            Write(message);
+        }
+
+        // Checked before a message is formatted, so that a sink nobody listens to costs next to nothing
+        virtual bool IsListening(Level /*level*/) const noexcept
+        {
+            return true;
+        }
     };
 
-    class CsvTracer final : public ITracer
+    /// <summary>
+    /// Forwards every message to several sinks (e.g. a trace file & ETW)
+    /// </summary>
+    class FanoutTracer final : public ITracer
     {
     public:
-        explicit CsvTracer(const std::filesystem::path& filePath);
-        ~CsvTracer();
-        void Write(std::string_view msg) override;
+        void Add(std::unique_ptr<ITracer> tracer)
+        {
+            _tracers.push_back(std::move(tracer));
+        }
 
-    private:
-        void WriteAllMessages();
-        auto Stream() noexcept -> std::ostream&;
+        void Write(std::string_view message) override
+        {
+            Write(Level::Info, message);
+        }
 
-        struct TraceData;
+        void Write(std::string_view phase, std::chrono::nanoseconds duration, std::string_view message) override
+        {
+            // Durations are written at Info
+            for (const auto& tracer : _tracers)
+            {
+                if (tracer->IsListening(Level::Info))
+                {
+                    tracer->Write(phase, duration, message);
+                }
+            }
+        }
 
-        Concurrency::unbounded_buffer<std::shared_ptr<TraceData>> _buffer;
-        std::future<void> _writeTask;
-        Concurrency::cancellation_token_source _cts;
-        std::ofstream _ofstream;
-        std::binary_semaphore _buffSemaphore{ 0 };
+        void Write(Level level, std::string_view message) override
+        {
+            for (const auto& tracer : _tracers)
+            {
+                if (tracer->IsListening(level))
+                {
+                    tracer->Write(level, message);
+                }
+            }
+        }
+
+        bool IsListening(Level level) const noexcept override
+        {
+            return std::ranges::any_of(_tracers, [level](const auto& tracer) { return tracer->IsListening(level); });
+        }
+
+    private:
+        std::vector<std::unique_ptr<ITracer>> _tracers;
     };
 
-    struct CsvTracer::TraceData
+    /// <summary>
+    /// A view of a single trace message handed to formatters
+    /// </summary>
+    struct TraceRecord
     {
         DWORD ThreadId = 0;
         std::chrono::system_clock::time_point Time;
-        std::string Message;
+        std::optional<std::chrono::nanoseconds> Duration;
+        std::string_view Phase;
+        std::span<char> Message;
+    };
+
+    /// <summary>
+    /// A slot of the trace buffer. Phase & message are stored back to back in the inline storage.
+    /// A message that does not fit spills into Overflow, whose capacity stays with the slot for reuse.
+    /// </summary>
+    struct TraceData
+    {
+        static constexpr std::size_t InlineCapacity = 512;
+
+        DWORD ThreadId = 0;
+        std::chrono::system_clock::time_point Time;
+        std::optional<std::chrono::nanoseconds> Duration;
+        std::size_t PhaseLength = 0;
+        std::size_t MessageLength = 0;
+        bool UsesOverflow = false;
+        std::array<char, InlineCapacity> Inline;
+        std::string Overflow;
+
+        void Assign(const std::string_view phase, const std::optional<std::chrono::nanoseconds> duration, const std::string_view message)
+        {
+            ThreadId = GetCurrentThreadId();
+            Time = std::chrono::system_clock::now();
+            Duration = duration;
+            PhaseLength = phase.size();
+            MessageLength = message.size();
+            UsesOverflow = PhaseLength + MessageLength > Inline.size();
+
+            if (UsesOverflow)
+            {
+                Overflow.resize(PhaseLength + MessageLength);
+            }
+
+            auto data = Data();
+            phase.copy(data, PhaseLength);
+            message.copy(data + PhaseLength, MessageLength);
+        }
+
+        char* Data() noexcept
+        {
+            return UsesOverflow ? Overflow.data() : Inline.data();
+        }
+
+        TraceRecord View() noexcept
+        {
+            return TraceRecord{
+                .ThreadId = ThreadId,
+                .Time = Time,
+                .Duration = Duration,
+                .Phase = { Data(), PhaseLength },
+                .Message = { Data() + PhaseLength, MessageLength } };
+        }
+    };
+
+    /// <summary>
+    /// Formats records as CSV lines: date-time,thread-id,phase,duration-ms,message
+    /// </summary>
+    class CsvFormatter final
+    {
+    public:
+        void WriteHeader(std::string& out)
+        {
+            out.append("date-time,thread-id,phase,duration-ms,message\n");
+        }
+
+        void Format(const TraceRecord& record, std::string& out)
+        {
+            // Replace all occurrences of double-quotation (") with a sigle-quotation (')
+            // Not using std::execution::par with std::replace() here because it's actually faster with sequential processing.
+            std::ranges::replace(record.Message, '"', '\'');
+
+            // Create a view without the last newline char if any
+            auto view = std::string_view{ record.Message.data(), record.Message.size() };
+
+            if (view.ends_with('\n'))
+            {
+                view.remove_suffix(1);
+            }
+
+            auto it = _timestamp.Format(std::back_inserter(out), record.Time);
+            it = std::format_to(it, ",{},{},", record.ThreadId, record.Phase);
+
+            // Duration column is empty for plain messages
+            if (record.Duration.has_value())
+            {
+                it = std::format_to(it, "{:.3f}", std::chrono::duration<double, std::milli>{ *record.Duration }.count());
+            }
+
+            std::format_to(it, ",\"{}\"\n", view);
+        }
+
+    private:
+        TimestampFormatter _timestamp;
+    };
+
+    /// <summary>
+    /// Binary trace layout (little endian, native size of each field):
+    ///   File header: Magic[8], Version(u32), system_clock period numerator(i64) & denominator(i64)
+    ///   Record:      Size(u32, bytes following this field), Ticks(i64), ThreadId(u32), Duration in ns(i64, NoDuration if none),
+    ///                PhaseLength(u32), Phase, Message
+    /// Messages are stored as is; quotes & trailing newlines are handled when converted to CSV.
+    /// </summary>
+    namespace BinaryFormat
+    {
+        inline constexpr auto Magic = std::string_view{ "GTTRACE\0", 8 };
+        inline constexpr auto Version = std::uint32_t{ 1 };
+        inline constexpr auto NoDuration = std::numeric_limits<std::int64_t>::min();
+        inline constexpr auto RecordFixedSize = sizeof(std::int64_t) + sizeof(std::uint32_t) + sizeof(std::int64_t) + sizeof(std::uint32_t);
+
+        template <typename T>
+        void Append(std::string& out, const T value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        template <typename T>
+        T Read(const char* data) noexcept
+        {
+            auto value = T{};
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+    }
+
+    class BinaryFormatter final
+    {
+    public:
+        void WriteHeader(std::string& out)
+        {
+            using Period = std::chrono::system_clock::period;
+
+            out.append(BinaryFormat::Magic);
+            BinaryFormat::Append(out, BinaryFormat::Version);
+            BinaryFormat::Append(out, static_cast<std::int64_t>(Period::num));
+            BinaryFormat::Append(out, static_cast<std::int64_t>(Period::den));
+        }
+
+        void Format(const TraceRecord& record, std::string& out)
+        {
+            const auto size = BinaryFormat::RecordFixedSize + record.Phase.size() + record.Message.size();
+
+            BinaryFormat::Append(out, static_cast<std::uint32_t>(size));
+            BinaryFormat::Append(out, static_cast<std::int64_t>(record.Time.time_since_epoch().count()));
+            BinaryFormat::Append(out, static_cast<std::uint32_t>(record.ThreadId));
+            BinaryFormat::Append(out, record.Duration.has_value() ? static_cast<std::int64_t>(record.Duration->count()) : BinaryFormat::NoDuration);
+            BinaryFormat::Append(out, static_cast<std::uint32_t>(record.Phase.size()));
+            out.append(record.Phase);
+            out.append(record.Message.data(), record.Message.size());
+        }
+    };
+
+    /// <summary>
+    /// Writes the batches of a FileTracer to a single file that grows without limit
+    /// </summary>
+    class FileOutput final
+    {
+    public:
+        FileOutput(const std::filesystem::path& filePath, const TraceOptions& /*options*/, std::string_view header)
+        {
+            _file.attach(::CreateFileW(filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+
+            if (not _file)
+            {
+                throw std::runtime_error{ std::format("Failed to open {}. CreateFileW failed with {}", Util::to_string(filePath.c_str()), ::GetLastError()) };
+            }
+
+            Write(header);
+        }
+
+        // Bytes that can be written before the output moves on to another file
+        std::size_t Remaining() const noexcept
+        {
+            return std::numeric_limits<std::size_t>::max();
+        }
+
+        void Write(std::string_view data) noexcept
+        {
+            while (not data.empty())
+            {
+                auto written = DWORD{};
+
+                if (not ::WriteFile(_file.get(), data.data(), static_cast<DWORD>(data.size()), &written, nullptr) || written == 0)
+                {
+                    // Nothing more can be done for a failed trace write
+                    break;
+                }
+
+                data.remove_prefix(written);
+            }
+        }
 
-        explicit TraceData(const std::string_view message)
-            : ThreadId{ GetCurrentThreadId() }, Time{ std::chrono::system_clock::now() }, Message{ message }
-        {}
+    private:
+        winrt::file_handle _file;
     };
 
-    inline CsvTracer::CsvTracer(const std::filesystem::path& filePath) :
-        _ofstream{ filePath }
+    /// <summary>
+    /// Writes the batches of a FileTracer into preallocated memory-mapped files of TraceOptions::MaxFileSize bytes,
+    /// named after the given path with a sequence number (e.g. GetToken_20240123_123456_001.log, _002.log, ...).
+    /// A write is a copy into the view; only moving on to the next file touches the file system, and that happens on the
+    /// consumer thread, so writers keep filling the ring buffer meanwhile. Every file starts with the formatter's header
+    /// and holds whole records, so each one can be read or converted on its own. The oldest files beyond
+    /// TraceOptions::MaxFiles are deleted.
+    /// </summary>
+    class RotatingOutput final
     {
-        if (not _ofstream.good())
+    public:
+        RotatingOutput(const std::filesystem::path& filePath, const TraceOptions& options, std::string_view header) :
+            _path{ filePath },
+            _maxFileSize{ options.MaxFileSize },
+            _maxFiles{ std::max<std::size_t>(options.MaxFiles, 1) },
+            _header{ header }
+        {
+            if (_maxFileSize <= _header.size())
+            {
+                throw std::runtime_error{ std::format("The trace file size ({} bytes) must be larger than its header", _maxFileSize) };
+            }
+
+            Roll();
+        }
+
+        RotatingOutput(const RotatingOutput&) = delete;
+        RotatingOutput& operator=(const RotatingOutput&) = delete;
+
+        ~RotatingOutput()
+        {
+            if (_current)
+            {
+                _current->Close(_used);
+            }
+        }
+
+        std::size_t Remaining() const noexcept
         {
-            throw std::runtime_error{ std::format("Failed to open {}", Util::to_string(filePath.c_str())) };
+            return _current ? _current->Size() - _used : 0;
+        }
+
+        void Write(std::string_view data) noexcept
+        {
+            try
+            {
+                while (not data.empty())
+                {
+                    // Start a new file rather than split a batch. Only a record larger than a whole file is split.
+                    if (not _current || (data.size() > Remaining() && _used > _header.size()))
+                    {
+                        Roll();
+                    }
+
+                    const auto count = std::min(data.size(), Remaining());
+                    std::memcpy(_current->Data() + _used, data.data(), count);
+                    _used += count;
+                    data.remove_prefix(count);
+                }
+            }
+            catch (...)
+            {
+                // The next file could not be created (e.g. the disk is full). The batch is lost; the next one tries again.
+            }
         }
 
+    private:
+        /// <summary>
+        /// Close the current file at its used size, delete the oldest ones, and start the next file. Throws on failure.
+        /// </summary>
+        void Roll()
+        {
+            if (_current)
+            {
+                _current->Close(_used);
+                _current.reset();
+            }
+
+            while (_files.size() >= _maxFiles)
+            {
+                auto ec = std::error_code{};
+                std::filesystem::remove(_files.front(), ec);
+                _files.pop_front();
+            }
+
+            auto path = _path;
+            path.replace_filename(std::format(L"{}_{:03}{}", _path.stem().native(), ++_sequence, _path.extension().native()));
+
+            _current = std::make_unique<Util::MappedFile>(path, _maxFileSize);
+            _files.push_back(std::move(path));
+
+            std::memcpy(_current->Data(), _header.data(), _header.size());
+            _used = _header.size();
+        }
+
+        const std::filesystem::path _path;
+        const std::size_t _maxFileSize;
+        const std::size_t _maxFiles;
+        const std::string _header;
+        std::deque<std::filesystem::path> _files;   // Oldest first, including the current one
+        std::unique_ptr<Util::MappedFile> _current;
+        std::size_t _used = 0;
+        std::size_t _sequence = 0;
+    };
+
+    /// <summary>
+    /// Tracer that buffers messages in a ring buffer and writes them to a file from a consumer thread.
+    /// Formatter decides the file layout (CsvFormatter or BinaryFormatter), and Output where the bytes go
+    /// (FileOutput or RotatingOutput).
+    /// </summary>
+    template <typename Formatter, typename Output = FileOutput>
+    class FileTracer final : public ITracer
+    {
+    public:
+        explicit FileTracer(const std::filesystem::path& filePath, const TraceOptions& options = {});
+        ~FileTracer();
+        void Write(std::string_view msg) override;
+        void Write(std::string_view phase, std::chrono::nanoseconds duration, std::string_view msg) override;
+
+    private:
+        void Push(std::string_view phase, std::optional<std::chrono::nanoseconds> duration, std::string_view message);
+        void WakeConsumer() noexcept;
+        void WriteAllMessages();
+        void FlushBatch() noexcept;
+
+        static std::string GetHeader()
+        {
+            auto header = std::string{};
+            Formatter{}.WriteHeader(header);
+            return header;
+        }
+
+        // A batch larger than this is written before draining the rest of the buffer
+        static constexpr std::size_t MaxBatchSize = 1024 * 1024;
+
+        const OverflowPolicy _overflow;
+        const std::chrono::milliseconds _flushInterval;
+        std::unique_ptr<Util::RingBuffer<TraceData>> _buffer;
+        std::atomic<std::uint64_t> _dropped{ 0 };
+        std::atomic<bool> _consumerWaiting{ false };
+        std::atomic<bool> _stopping{ false };
+        std::counting_semaphore<> _buffSemaphore{ 0 };
+        std::future<void> _writeTask;
+        Output _output;
+
+        // Only touched by the consumer
+        std::string _batch;
+        Formatter _formatter;
+    };
+
+    using CsvTracer = FileTracer<CsvFormatter>;
+    using BinaryTracer = FileTracer<BinaryFormatter>;
+    using RotatingCsvTracer = FileTracer<CsvFormatter, RotatingOutput>;
+    using RotatingBinaryTracer = FileTracer<BinaryFormatter, RotatingOutput>;
+
+    template <typename Formatter, typename Output>
+    inline FileTracer<Formatter, Output>::FileTracer(const std::filesystem::path& filePath, const TraceOptions& options) :
+        _overflow{ options.Overflow },
+        _flushInterval{ options.FlushInterval },
+        _buffer{ std::make_unique<Util::RingBuffer<TraceData>>(options.BufferSize) },
+        _output{ filePath, options, GetHeader() }
+    {
+        _batch.reserve(64 * 1024);
+
         // Start a consumer
         _writeTask = std::async(
             std::launch::async,
-            [this, cancelToken = _cts.get_token()]() {
+            [this]() {
                 while (true) {
-                    _buffSemaphore.acquire();
                     WriteAllMessages();
 
-                    if (cancelToken.is_canceled())
+                    if (_stopping.load())
                     {
                         return;
                     }
+
+                    // Tell writers to wake me up, then sleep unless something arrived in the meantime
+                    _consumerWaiting.store(true);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                    if (_flushInterval.count() > 0)
+                    {
+                        // Writers do not signal in this mode except when they are blocked on a full buffer
+                        (void)_buffSemaphore.try_acquire_for(_flushInterval);
+                    }
+                    else if (_buffer->Empty() && not _stopping.load())
+                    {
+                        _buffSemaphore.acquire();
+                    }
+
+                    _consumerWaiting.store(false);
                 }
             });
-
-        // Write the header
-        std::println(Stream(), "date-time,thread-id,message");
     }
 
-    inline CsvTracer::~CsvTracer()
+    template <typename Formatter, typename Output>
+    inline FileTracer<Formatter, Output>::~FileTracer()
     {
         // Stop consumer
-        _cts.cancel();
+        _stopping.store(true);
         _buffSemaphore.release();
 
         // Wait for the consumer to exit
@@ -102,41 +720,257 @@ namespace Diagnostics::Trace::detail
         WriteAllMessages();
     }
 
-    inline void CsvTracer::Write(std::string_view message)
+    template <typename Formatter, typename Output>
+    inline void FileTracer<Formatter, Output>::Write(std::string_view message)
     {
-        Concurrency::send(_buffer, std::make_shared<TraceData>(message));
-        _buffSemaphore.release();
+        Push({}, std::nullopt, message);
+    }
+
+    template <typename Formatter, typename Output>
+    inline void FileTracer<Formatter, Output>::Write(std::string_view phase, std::chrono::nanoseconds duration, std::string_view message)
+    {
+        Push(phase, duration, message);
     }
 
-    inline void CsvTracer::WriteAllMessages()
+    template <typename Formatter, typename Output>
+    inline void FileTracer<Formatter, Output>::Push(std::string_view phase, std::optional<std::chrono::nanoseconds> duration, std::string_view message)
     {
-        auto data = std::shared_ptr<TraceData>{};
+        auto fill = [&](TraceData& data) { data.Assign(phase, duration, message); };
 
-        while (Concurrency::try_receive(_buffer, data))
+        while (not _buffer->TryPush(fill))
         {
-            // Replace all occurrences of double-quotation (") with a sigle-quotation (')
-            // Not using std::execution::par with std::replace() here because it's actually faster with sequential processing.
-            std::ranges::replace(data->Message, '"', '\'');
+            if (_overflow == OverflowPolicy::CountDropped)
+            {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
 
-            // Create a view without the last newline char if any
-            auto view = std::string_view{ data->Message };
+            if (_overflow == OverflowPolicy::DropOldest)
+            {
+                if (_buffer->TryPop([](TraceData&) {}))
+                {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                // OverflowPolicy::Block: sleep until the consumer frees a slot rather than spin, so a stalled consumer
+                // (e.g. a slow disk during rotation) costs the producers no CPU
+                WakeConsumer();
+                const auto popCount = _buffer->PopCount();
 
-            if (view.ends_with('\n'))
+                if (_buffer->TryPush(fill))
+                {
+                    break;
+                }
+
+                _buffer->WaitForPop(popCount);
+            }
+        }
+
+        if (_flushInterval.count() == 0)
+        {
+            WakeConsumer();
+        }
+    }
+
+    template <typename Formatter, typename Output>
+    inline void FileTracer<Formatter, Output>::WakeConsumer() noexcept
+    {
+        // Only signal when the consumer is (about to be) sleeping, so that most writes do not touch the semaphore.
+        // The fence pairs with the one in the consumer so that either the consumer sees the new message or the writer sees the flag.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (_consumerWaiting.load(std::memory_order_relaxed) && _consumerWaiting.exchange(false))
+        {
+            _buffSemaphore.release();
+        }
+    }
+
+    /// <summary>
+    /// Drain the buffer, format all messages into a single batch, and write it with one WriteFile call
+    /// </summary>
+    template <typename Formatter, typename Output>
+    inline void FileTracer<Formatter, Output>::WriteAllMessages()
+    {
+        const auto format = [this](TraceData& data) {
+            const auto start = _batch.size();
+            _formatter.Format(data.View(), _batch);
+
+            // A record that does not fit in the rest of the current file goes to the next one, after the records before it
+            if (_batch.size() > _output.Remaining() && start > 0)
             {
-                view.remove_suffix(1);
+                _output.Write(std::string_view{ _batch }.substr(0, start));
+                _batch.erase(0, start);
+            }
+        };
+
+        while (_buffer->TryPop(format))
+        {
+            if (_batch.size() >= MaxBatchSize)
+            {
+                FlushBatch();
             }
+        }
+
+        if (auto dropped = _dropped.exchange(0); dropped > 0)
+        {
+            auto message = std::format("{} trace messages were dropped because the trace buffer was full", dropped);
 
-            std::println(Stream(), "{0:%F}T{0:%T%z},{1},\"{2}\"", data->Time, data->ThreadId, view);
+            _formatter.Format(
+                TraceRecord{ .ThreadId = GetCurrentThreadId(), .Time = std::chrono::system_clock::now(), .Message = message },
+                _batch);
         }
+
+        FlushBatch();
     }
 
-    inline auto CsvTracer::Stream() noexcept -> std::ostream&
+    template <typename Formatter, typename Output>
+    inline void FileTracer<Formatter, Output>::FlushBatch() noexcept
     {
-        return _ofstream;
+        _output.Write(_batch);
+        _batch.clear();
+    }
+
+    /// <summary>
+    /// Expand a binary trace file into the CSV layout written by CsvTracer
+    /// </summary>
+    inline void ConvertBinaryToCsv(const std::filesystem::path& binaryPath, const std::filesystem::path& csvPath)
+    {
+        using namespace std::chrono;
+
+        auto input = std::ifstream{ binaryPath, std::ios::binary };
+
+        if (not input)
+        {
+            throw std::runtime_error{ std::format("Failed to open {}", binaryPath.string()) };
+        }
+
+        // Validate the file header
+        auto header = std::array<char, BinaryFormat::Magic.size() + sizeof(std::uint32_t) + 2 * sizeof(std::int64_t)>{};
+
+        if (not input.read(header.data(), header.size()) || std::string_view{ header.data(), BinaryFormat::Magic.size() } != BinaryFormat::Magic)
+        {
+            throw std::runtime_error{ std::format("{} is not a binary trace file", binaryPath.string()) };
+        }
+
+        const auto version = BinaryFormat::Read<std::uint32_t>(header.data() + BinaryFormat::Magic.size());
+        const auto num = BinaryFormat::Read<std::int64_t>(header.data() + BinaryFormat::Magic.size() + sizeof(std::uint32_t));
+        const auto den = BinaryFormat::Read<std::int64_t>(header.data() + BinaryFormat::Magic.size() + sizeof(std::uint32_t) + sizeof(std::int64_t));
+
+        if (version != BinaryFormat::Version || num != system_clock::period::num || den != system_clock::period::den)
+        {
+            throw std::runtime_error{ std::format("{} has an unsupported version ({}) or clock period ({}/{})", binaryPath.string(), version, num, den) };
+        }
+
+        // Opening the output truncates it, so it must not be the input under another name
+        auto error = std::error_code{};
+
+        if (std::filesystem::equivalent(binaryPath, csvPath, error))
+        {
+            throw std::runtime_error{ std::format("The CSV file {} is the binary trace file itself", csvPath.string()) };
+        }
+
+        auto output = std::ofstream{ csvPath, std::ios::binary | std::ios::trunc };
+
+        if (not output)
+        {
+            throw std::runtime_error{ std::format("Failed to open {}", csvPath.string()) };
+        }
+
+        auto formatter = CsvFormatter{};
+        auto batch = std::string{};
+        auto record = std::string{};
+        formatter.WriteHeader(batch);
+
+        auto size = std::uint32_t{};
+
+        while (input.read(reinterpret_cast<char*>(&size), sizeof(size)))
+        {
+            // The zero-filled tail of a rotating trace file that was not closed (e.g. the process was terminated)
+            if (size == 0)
+            {
+                break;
+            }
+
+            if (size < BinaryFormat::RecordFixedSize)
+            {
+                throw std::runtime_error{ std::format("{} has a corrupted record", binaryPath.string()) };
+            }
+
+            record.resize(size);
+
+            if (not input.read(record.data(), size))
+            {
+                // Truncated at the end (e.g. the process was terminated while writing)
+                break;
+            }
+
+            auto data = record.data();
+            const auto ticks = BinaryFormat::Read<std::int64_t>(data);
+            const auto threadId = BinaryFormat::Read<std::uint32_t>(data + 8);
+            const auto duration = BinaryFormat::Read<std::int64_t>(data + 12);
+            const auto phaseLength = BinaryFormat::Read<std::uint32_t>(data + 20);
+
+            if (phaseLength > size - BinaryFormat::RecordFixedSize)
+            {
+                throw std::runtime_error{ std::format("{} has a corrupted record", binaryPath.string()) };
+            }
+
+            const auto phase = std::string_view{ data + BinaryFormat::RecordFixedSize, phaseLength };
+            const auto message = std::span<char>{ data + BinaryFormat::RecordFixedSize + phaseLength, size - BinaryFormat::RecordFixedSize - phaseLength };
+
+            formatter.Format(
+                TraceRecord{
+                    .ThreadId = threadId,
+                    .Time = system_clock::time_point{ system_clock::duration{ ticks } },
+                    .Duration = duration == BinaryFormat::NoDuration ? std::nullopt : std::optional{ nanoseconds{ duration } },
+                    .Phase = phase,
+                    .Message = message },
+                batch);
+
+            if (batch.size() >= 1024 * 1024)
+            {
+                output.write(batch.data(), batch.size());
+                batch.clear();
+            }
+        }
+
+        output.write(batch.data(), batch.size());
+
+        if (not output)
+        {
+            throw std::runtime_error{ std::format("Failed to write {}", csvPath.string()) };
+        }
     }
 
     // ITracer instance
     inline auto _tracer = std::unique_ptr<ITracer>{};
+
+    /// <summary>
+    /// Install a sink. A second sink turns the tracer into a FanoutTracer of both.
+    /// Not thread-safe: sinks are added at startup, before anything is written.
+    /// </summary>
+    inline void AddTracer(std::unique_ptr<ITracer> tracer)
+    {
+        if (not _tracer)
+        {
+            _tracer = std::move(tracer);
+            return;
+        }
+
+        auto fanout = dynamic_cast<FanoutTracer*>(_tracer.get());
+
+        if (not fanout)
+        {
+            auto newFanout = std::make_unique<FanoutTracer>();
+            newFanout->Add(std::move(_tracer));
+            fanout = newFanout.get();
+            _tracer = std::move(newFanout);
+        }
+
+        fanout->Add(std::move(tracer));
+    }
 } // end of namespace Diagnostics::Trace::detail
 
 namespace Diagnostics::Trace
@@ -146,17 +980,47 @@ namespace Diagnostics::Trace
         return !!detail::_tracer;
     }
 
-    inline void Enable(std::filesystem::path path)
+    /// <summary>
+    /// Start writing a trace file. Other sinks (e.g. EnableEtw() in etw.h) can be added next to it.
+    /// </summary>
+    inline void Enable(std::filesystem::path path, const TraceOptions& options = {})
     {
-        using detail::_tracer;
+        using detail::BinaryTracer;
         using detail::CsvTracer;
+        using detail::RotatingBinaryTracer;
+        using detail::RotatingCsvTracer;
 
         if (IsEnabled())
         {
             throw std::runtime_error{ "Trace has been already initialized" };
         }
 
-        _tracer = std::make_unique<CsvTracer>(path);
+        const auto rotating = options.MaxFileSize > 0;
+
+        if (options.Format == TraceFormat::Binary && rotating)
+        {
+            detail::AddTracer(std::make_unique<RotatingBinaryTracer>(path, options));
+        }
+        else if (options.Format == TraceFormat::Binary)
+        {
+            detail::AddTracer(std::make_unique<BinaryTracer>(path, options));
+        }
+        else if (rotating)
+        {
+            detail::AddTracer(std::make_unique<RotatingCsvTracer>(path, options));
+        }
+        else
+        {
+            detail::AddTracer(std::make_unique<CsvTracer>(path, options));
+        }
+    }
+
+    /// <summary>
+    /// Convert a binary trace file to the CSV layout
+    /// </summary>
+    inline void ConvertToCsv(const std::filesystem::path& binaryPath, const std::filesystem::path& csvPath)
+    {
+        detail::ConvertBinaryToCsv(binaryPath, csvPath);
     }
 
     inline void Disable() noexcept
@@ -169,25 +1033,79 @@ namespace Diagnostics::Trace
         }
     }
 
-    template <class... Args>
+    /// <summary>
+    /// Write the duration of a phase as structured columns
+    /// </summary>
+    inline void WriteDuration(std::string_view phase, std::chrono::nanoseconds duration)
+    {
+        using detail::_tracer;
+
+        if (IsLevelEnabled<Level::Info>() && IsEnabled() && _tracer->IsListening(Level::Info))
+        {
+            auto& buffer = detail::MessageBuffer();
+            buffer.clear();
+            std::format_to(std::back_inserter(buffer), "{} took {:.3f} ms", phase, std::chrono::duration<double, std::milli>{ duration }.count());
+            _tracer->Write(phase, duration, buffer);
+        }
+    }
+
+    /// <summary>
+    /// Write the duration of a phase as structured columns, with a message of its own (e.g. the values measured in that time)
+    /// </summary>
+    inline void WriteDuration(std::string_view phase, std::chrono::nanoseconds duration, std::string_view message)
+    {
+        using detail::_tracer;
+
+        if (IsLevelEnabled<Level::Info>() && IsEnabled() && _tracer->IsListening(Level::Info))
+        {
+            _tracer->Write(phase, duration, message);
+        }
+    }
+
+    /// <summary>
+    /// Write an already formatted UTF-8 message as is
+    /// </summary>
+    template <Level level = Level::Info>
+    void WriteRaw(std::string_view message)
+    {
+        using detail::_tracer;
+
+        if (IsLevelEnabled<level>() && IsEnabled() && _tracer->IsListening(level))
+        {
+            _tracer->Write(level, message);
+        }
+    }
+
+    template <Level level = Level::Info, class... Args>
     void Write(const std::format_string<Args...> format, Args&&... args)
     {
         using detail::_tracer;
 
-        if (IsEnabled())
+        if (IsLevelEnabled<level>() && IsEnabled() && _tracer->IsListening(level))
         {
-            _tracer->Write(std::format(format, std::forward<Args>(args)...));
+            // Reuse the per-thread buffer so that formatting does not allocate once the buffer has grown
+            auto& buffer = detail::MessageBuffer();
+            buffer.clear();
+            std::format_to(std::back_inserter(buffer), format, std::forward<Args>(args)...);
+            _tracer->Write(level, buffer);
         }
     }
 
-    template <class... Args>
+    template <Level level = Level::Info, class... Args>
     void Write(const std::wformat_string<Args...> format, Args&&... args)
     {
         using detail::_tracer;
 
-        if (IsEnabled())
+        if (IsLevelEnabled<level>() && IsEnabled() && _tracer->IsListening(level))
         {
-            _tracer->Write(Util::to_string(std::format(format, std::forward<Args>(args)...)));
+            // Same as above, but the wide message is formatted into a second per-thread buffer first
+            thread_local auto wbuffer = std::wstring{};
+            auto& buffer = detail::MessageBuffer();
+            wbuffer.clear();
+            buffer.clear();
+            std::format_to(std::back_inserter(wbuffer), format, std::forward<Args>(args)...);
+            Util::to_string(wbuffer, buffer);
+            _tracer->Write(level, buffer);
         }
     }
 }
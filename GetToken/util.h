@@ -3,10 +3,18 @@
 */
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
 #include <expected>
 #include <format>
 #include <filesystem>
+#include <initializer_list>
 #include <string>
+#include <string_view>
+#include <utility>
 
 #ifndef WIN32_MEAN_AND_LEAN
 #define WIN32_MEAN_AND_LEAN
@@ -18,6 +26,10 @@
 
 #include <Windows.h>
 
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#endif
+
 #define SECURITY_WIN32
 #include <security.h>
 
@@ -35,65 +47,107 @@ using namespace Windows::Security::Authentication::Web::Core;
 
 namespace Util::detail
 {
-    // Maps to convert some enums to strings
-#define MAPENTRY(value) { value, #value }
-
-    inline extern const auto WebAccountStateMap = std::unordered_map<WebAccountState, std::string>
+    /// <summary>
+    /// Build a table of enum names indexed by the enum value, at compile time.
+    /// Size is the largest value + 1; a value out of range fails to compile. Values without an entry have an empty name.
+    /// </summary>
+    template <std::size_t Size, typename Enum>
+    constexpr auto MakeNameTable(std::initializer_list<std::pair<Enum, std::string_view>> entries)
     {
-        MAPENTRY(WebAccountState::None),
-        MAPENTRY(WebAccountState::Connected),
-        MAPENTRY(WebAccountState::Error)
-    };
+        auto table = std::array<std::string_view, Size>{};
 
-    inline extern const auto FindAllWebAccountsStatusMap = std::unordered_map<FindAllWebAccountsStatus, std::string>
-    {
-        MAPENTRY(FindAllWebAccountsStatus::Success),
-        MAPENTRY(FindAllWebAccountsStatus::ProviderError),
-        MAPENTRY(FindAllWebAccountsStatus::NotAllowedByProvider),
-        MAPENTRY(FindAllWebAccountsStatus::NotSupportedByProvider)
-    };
+        for (const auto& [value, name] : entries)
+        {
+            table[static_cast<std::size_t>(value)] = name;
+        }
+
+        return table;
+    }
 
-    inline extern const auto WebTokenRequestStatusMap = std::unordered_map<WebTokenRequestStatus, std::string>
+    /// <returns>The name of the value, or an empty string for a value the table does not know (e.g. one added by a newer OS)</returns>
+    template <typename Enum, std::size_t Size>
+    constexpr std::string_view GetName(const std::array<std::string_view, Size>& table, const Enum value) noexcept
     {
-        MAPENTRY(WebTokenRequestStatus::AccountProviderNotAvailable),
-        MAPENTRY(WebTokenRequestStatus::AccountSwitch),
-        MAPENTRY(WebTokenRequestStatus::ProviderError),
-        MAPENTRY(WebTokenRequestStatus::Success),
-        MAPENTRY(WebTokenRequestStatus::UserCancel),
-        MAPENTRY(WebTokenRequestStatus::UserInteractionRequired),
-    };
+        // A negative value wraps around to a large index
+        const auto index = static_cast<std::size_t>(value);
+        return index < Size ? table[index] : std::string_view{};
+    }
+
+    inline constexpr auto UnknownName = std::string_view{ "Unknown" };
+
+    // Tables to convert some enums to strings
+#define NAMEENTRY(value) std::pair{ value, std::string_view{ #value } }
+
+    inline constexpr auto WebAccountStateNames = MakeNameTable<3>({
+        NAMEENTRY(WebAccountState::None),
+        NAMEENTRY(WebAccountState::Connected),
+        NAMEENTRY(WebAccountState::Error)
+    });
+
+    inline constexpr auto FindAllWebAccountsStatusNames = MakeNameTable<4>({
+        NAMEENTRY(FindAllWebAccountsStatus::Success),
+        NAMEENTRY(FindAllWebAccountsStatus::ProviderError),
+        NAMEENTRY(FindAllWebAccountsStatus::NotAllowedByProvider),
+        NAMEENTRY(FindAllWebAccountsStatus::NotSupportedByProvider)
+    });
 
-    inline extern const auto WebTokenRequestPromptTypeMap = std::unordered_map<WebTokenRequestPromptType, std::string>
+    inline constexpr auto WebTokenRequestStatusNames = MakeNameTable<6>({
+        NAMEENTRY(WebTokenRequestStatus::AccountProviderNotAvailable),
+        NAMEENTRY(WebTokenRequestStatus::AccountSwitch),
+        NAMEENTRY(WebTokenRequestStatus::ProviderError),
+        NAMEENTRY(WebTokenRequestStatus::Success),
+        NAMEENTRY(WebTokenRequestStatus::UserCancel),
+        NAMEENTRY(WebTokenRequestStatus::UserInteractionRequired),
+    });
+
+    inline constexpr auto WebTokenRequestPromptTypeNames = MakeNameTable<2>({
+        NAMEENTRY(WebTokenRequestPromptType::Default),
+        NAMEENTRY(WebTokenRequestPromptType::ForceAuthentication)
+    });
+
+#undef NAMEENTRY
+
+    /// <summary>
+    /// Format the name of the value, or "Unknown (value)" for a value the table does not know
+    /// </summary>
+    template <typename Enum, std::size_t Size>
+    auto FormatName(const std::formatter<std::string_view>& formatter, const std::array<std::string_view, Size>& table, const Enum value, std::format_context& ctx)
     {
-        MAPENTRY(WebTokenRequestPromptType::Default),
-        MAPENTRY(WebTokenRequestPromptType::ForceAuthentication)
-    };
+        if (const auto name = GetName(table, value); not name.empty())
+        {
+            return formatter.format(name, ctx);
+        }
 
-#undef MAPENTRY
+        return std::format_to(ctx.out(), "{} ({})", UnknownName, static_cast<std::int64_t>(value));
+    }
 }
 
 namespace winrt::Windows::Security::Authentication::Web::Core
 {
     // Add to_string() functions in the same namespace as the target object so that ADL works.
 
-    inline const std::string& to_string(WebAccountState accountState) noexcept
+    inline constexpr std::string_view to_string(WebAccountState accountState) noexcept
     {
-        return Util::detail::WebAccountStateMap.at(accountState);
+        const auto name = Util::detail::GetName(Util::detail::WebAccountStateNames, accountState);
+        return name.empty() ? Util::detail::UnknownName : name;
     }
 
-    inline const std::string& to_string(FindAllWebAccountsStatus status) noexcept
+    inline constexpr std::string_view to_string(FindAllWebAccountsStatus status) noexcept
     {
-        return Util::detail::FindAllWebAccountsStatusMap.at(status);
+        const auto name = Util::detail::GetName(Util::detail::FindAllWebAccountsStatusNames, status);
+        return name.empty() ? Util::detail::UnknownName : name;
     }
 
-    inline const std::string& to_string(WebTokenRequestStatus status) noexcept
+    inline constexpr std::string_view to_string(WebTokenRequestStatus status) noexcept
     {
-        return Util::detail::WebTokenRequestStatusMap.at(status);
+        const auto name = Util::detail::GetName(Util::detail::WebTokenRequestStatusNames, status);
+        return name.empty() ? Util::detail::UnknownName : name;
     }
 
-    inline const std::string& to_string(WebTokenRequestPromptType prompt)
+    inline constexpr std::string_view to_string(WebTokenRequestPromptType prompt) noexcept
     {
-        return Util::detail::WebTokenRequestPromptTypeMap.at(prompt);
+        const auto name = Util::detail::GetName(Util::detail::WebTokenRequestPromptTypeNames, prompt);
+        return name.empty() ? Util::detail::UnknownName : name;
     }
 }
 
@@ -103,7 +157,7 @@ struct std::formatter<WebAccountState> : std::formatter<std::string_view>
 {
     auto format(const WebAccountState& val, std::format_context& ctx) const
     {
-        return std::formatter<std::string_view>::format(Util::detail::WebAccountStateMap.at(val), ctx);
+        return Util::detail::FormatName(*this, Util::detail::WebAccountStateNames, val, ctx);
     }
 };
 
@@ -112,7 +166,7 @@ struct std::formatter<FindAllWebAccountsStatus> : std::formatter<std::string_vie
 {
     auto format(const FindAllWebAccountsStatus& val, std::format_context& ctx) const
     {
-        return std::formatter<std::string_view>::format(Util::detail::FindAllWebAccountsStatusMap.at(val), ctx);
+        return Util::detail::FormatName(*this, Util::detail::FindAllWebAccountsStatusNames, val, ctx);
     }
 };
 
@@ -121,7 +175,7 @@ struct std::formatter<WebTokenRequestStatus> : std::formatter<std::string_view>
 {
     auto format(const WebTokenRequestStatus& val, std::format_context& ctx) const
     {
-        return std::formatter<std::string_view>::format(Util::detail::WebTokenRequestStatusMap.at(val), ctx);
+        return Util::detail::FormatName(*this, Util::detail::WebTokenRequestStatusNames, val, ctx);
     }
 };
 
@@ -130,12 +184,119 @@ struct std::formatter<WebTokenRequestPromptType> : std::formatter<std::string_vi
 {
     auto format(const WebTokenRequestPromptType& val, std::format_context& ctx) const
     {
-        return std::formatter<std::string_view>::format(Util::detail::WebTokenRequestPromptTypeMap.at(val), ctx);
+        return Util::detail::FormatName(*this, Util::detail::WebTokenRequestPromptTypeNames, val, ctx);
     }
 };
 
 namespace Util
 {
+    /// <summary>
+    /// Compare ASCII strings ignoring case
+    /// </summary>
+    inline bool EqualsIgnoreCase(std::string_view a, std::string_view b) noexcept
+    {
+        return std::ranges::equal(a, b, [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+
+    namespace detail
+    {
+        /// <summary>
+        /// Copy the leading ASCII characters of a UTF-16 string to dest.
+        /// </summary>
+        /// <returns>Number of characters copied. Conversion must continue from there if less than count.</returns>
+        inline std::size_t NarrowAscii(const wchar_t* src, const std::size_t count, char* dest) noexcept
+        {
+            auto i = std::size_t{};
+
+#if defined(_M_X64) || defined(_M_IX86)
+            // 8 UTF-16 code units at a time. All of them are ASCII when no bit above 0x7f is set.
+            const auto nonAscii = _mm_set1_epi16(static_cast<short>(0xff80));
+            const auto zero = _mm_setzero_si128();
+
+            for (; i + 8 <= count; i += 8)
+            {
+                const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, nonAscii), zero)) != 0xffff)
+                {
+                    break;
+                }
+
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + i), _mm_packus_epi16(chunk, chunk));
+            }
+#endif
+            for (; i < count && src[i] < 0x80; ++i)
+            {
+                dest[i] = static_cast<char>(src[i]);
+            }
+
+            return i;
+        }
+
+        /// <summary>
+        /// Copy the leading ASCII characters of a narrow string to dest.
+        /// </summary>
+        /// <returns>Number of characters copied. Conversion must continue from there if less than count.</returns>
+        inline std::size_t WidenAscii(const char* src, const std::size_t count, wchar_t* dest) noexcept
+        {
+            auto i = std::size_t{};
+
+#if defined(_M_X64) || defined(_M_IX86)
+            // 16 bytes at a time. All of them are ASCII when no high bit is set.
+            const auto zero = _mm_setzero_si128();
+
+            for (; i + 16 <= count; i += 16)
+            {
+                const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+                if (_mm_movemask_epi8(chunk) != 0)
+                {
+                    break;
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_unpacklo_epi8(chunk, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i + 8), _mm_unpackhi_epi8(chunk, zero));
+            }
+#endif
+            for (; i < count && static_cast<unsigned char>(src[i]) < 0x80; ++i)
+            {
+                dest[i] = static_cast<wchar_t>(src[i]);
+            }
+
+            return i;
+        }
+    }
+
+    /// <summary>
+    /// Append UTF-8 of the given string to out. Only one conversion is attempted and nothing is allocated when out has enough capacity.
+    /// ASCII characters are copied directly without WideCharToMultiByte.
+    /// </summary>
+    inline void to_string(std::wstring_view str, std::string& out)
+    {
+        if (str.empty())
+        {
+            return;
+        }
+
+        const auto offset = out.size();
+
+        // A UTF-16 code unit is at most 3 bytes in UTF-8 (a surrogate pair, 2 code units, is 4 bytes)
+        out.resize_and_overwrite(offset + str.size() * 3, [&](char* buffer, std::size_t size) noexcept {
+            const auto ascii = detail::NarrowAscii(str.data(), str.size(), buffer + offset);
+
+            if (ascii == str.size())
+            {
+                return offset + ascii;
+            }
+
+            const auto rest = str.substr(ascii);
+            const auto cb = ::WideCharToMultiByte(CP_UTF8, 0, rest.data(), static_cast<int>(rest.size()), buffer + offset + ascii, static_cast<int>(size - offset - ascii), nullptr, nullptr);
+            return offset + ascii + static_cast<std::size_t>(cb);
+        });
+    }
+
     inline std::string to_string(std::wstring_view str)
     {
         if (str.empty())
@@ -143,23 +304,58 @@ namespace Util
             return {};
         }
 
-        auto cb = ::WideCharToMultiByte(CP_UTF8, 0, str.data(), static_cast<int>(str.size()), nullptr, 0, nullptr, nullptr);
-        auto utf8 = std::string(cb, 0);
-        ::WideCharToMultiByte(CP_UTF8, 0, str.data(), static_cast<int>(str.size()), utf8.data(), cb, nullptr, nullptr);
+        // Try ASCII first, which needs neither sizing nor WideCharToMultiByte
+        auto utf8 = std::string{};
+        auto ascii = std::size_t{};
+
+        utf8.resize_and_overwrite(str.size(), [&](char* buffer, std::size_t size) noexcept {
+            ascii = detail::NarrowAscii(str.data(), size, buffer);
+            return ascii;
+        });
+
+        if (ascii < str.size())
+        {
+            const auto rest = str.substr(ascii);
+            auto cb = ::WideCharToMultiByte(CP_UTF8, 0, rest.data(), static_cast<int>(rest.size()), nullptr, 0, nullptr, nullptr);
+            utf8.resize(ascii + cb);
+            ::WideCharToMultiByte(CP_UTF8, 0, rest.data(), static_cast<int>(rest.size()), utf8.data() + ascii, cb, nullptr, nullptr);
+        }
 
         return utf8;
     }
 
-    inline std::wstring to_wstring(std::string_view str)
+    /// <summary>
+    /// Append the given string (in the ANSI code page, or codePage e.g. CP_UTF8) to out as UTF-16. Only one conversion is attempted.
+    /// ASCII characters are copied directly without MultiByteToWideChar.
+    /// </summary>
+    inline void to_wstring(std::string_view str, std::wstring& out, UINT codePage = CP_ACP)
     {
         if (str.empty())
         {
-            return {};
+            return;
         }
 
-        auto cch = ::MultiByteToWideChar(CP_ACP, 0, str.data(), static_cast<int>(str.size()), nullptr, 0);
-        auto wstr = std::wstring(cch, 0);
-        ::MultiByteToWideChar(CP_ACP, 0, str.data(), static_cast<int>(str.size()), wstr.data(), cch);
+        const auto offset = out.size();
+
+        // A byte is never more than one UTF-16 code unit
+        out.resize_and_overwrite(offset + str.size(), [&](wchar_t* buffer, std::size_t size) noexcept {
+            const auto ascii = detail::WidenAscii(str.data(), str.size(), buffer + offset);
+
+            if (ascii == str.size())
+            {
+                return offset + ascii;
+            }
+
+            const auto rest = str.substr(ascii);
+            const auto cch = ::MultiByteToWideChar(codePage, 0, rest.data(), static_cast<int>(rest.size()), buffer + offset + ascii, static_cast<int>(size - offset - ascii));
+            return offset + ascii + static_cast<std::size_t>(cch);
+        });
+    }
+
+    inline std::wstring to_wstring(std::string_view str)
+    {
+        auto wstr = std::wstring{};
+        to_wstring(str, wstr);
 
         return wstr;
     }
@@ -214,6 +410,32 @@ namespace Util
         return std::format("{}.{}.{}", major, minor, revision);
     }
 
+    /// <summary>
+    /// Time since this process was created, including the loader & CRT startup that no in-process timer can see
+    /// </summary>
+    inline std::chrono::nanoseconds GetProcessUptime() noexcept
+    {
+        auto creation = FILETIME{};
+        auto exit = FILETIME{};
+        auto kernel = FILETIME{};
+        auto user = FILETIME{};
+
+        if (!::GetProcessTimes(::GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        {
+            return {};
+        }
+
+        auto now = FILETIME{};
+        ::GetSystemTimePreciseAsFileTime(&now);
+
+        // FILETIME is in 100 ns units
+        const auto toTicks = [](const FILETIME& time) {
+            return (static_cast<std::uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+        };
+
+        return std::chrono::nanoseconds{ static_cast<std::int64_t>(toTicks(now) - toTicks(creation)) * 100 };
+    }
+
     inline std::expected<std::string, std::string> GetCurrentUserName()
     {
         auto name = std::wstring{};
@@ -0,0 +1,28 @@
+#ifndef GETTOKEN_VERSION_H
+#define GETTOKEN_VERSION_H
+
+// The single source of the version, shared by GetToken.rc (VERSIONINFO) & the code.
+// Compiled in, so that the version is printed without reading the file's version resource at startup.
+// Plain macros only: this file is also read by the resource compiler.
+#define GETTOKEN_VERSION_MAJOR 0
+#define GETTOKEN_VERSION_MINOR 3
+#define GETTOKEN_VERSION_PATCH 8
+#define GETTOKEN_VERSION_BUILD 0
+
+#define GETTOKEN_VERSION_STRINGIZE2(x) #x
+#define GETTOKEN_VERSION_STRINGIZE(x) GETTOKEN_VERSION_STRINGIZE2(x)
+
+// e.g. "0.3.8.0" for the version resource
+#define GETTOKEN_VERSION_STRING \
+    GETTOKEN_VERSION_STRINGIZE(GETTOKEN_VERSION_MAJOR) "." \
+    GETTOKEN_VERSION_STRINGIZE(GETTOKEN_VERSION_MINOR) "." \
+    GETTOKEN_VERSION_STRINGIZE(GETTOKEN_VERSION_PATCH) "." \
+    GETTOKEN_VERSION_STRINGIZE(GETTOKEN_VERSION_BUILD)
+
+// e.g. "0.3.8" for the console & trace (the build number is not shown)
+#define GETTOKEN_VERSION_DISPLAY_STRING \
+    GETTOKEN_VERSION_STRINGIZE(GETTOKEN_VERSION_MAJOR) "." \
+    GETTOKEN_VERSION_STRINGIZE(GETTOKEN_VERSION_MINOR) "." \
+    GETTOKEN_VERSION_STRINGIZE(GETTOKEN_VERSION_PATCH)
+
+#endif // GETTOKEN_VERSION_H
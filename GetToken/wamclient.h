@@ -0,0 +1,365 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <expected>
+#include <format>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "util.h"
+#include "wam.h"
+
+namespace WAM
+{
+    /// <summary>
+    /// The WAM calls that GetToken makes. WamClient forwards them to WebAuthenticationCoreManager, and SyntheticWamClient
+    /// answers them without a broker, so the rest of the tool (trace, output, scheduling) can be measured offline.
+    /// Implementations are called concurrently from any thread. Parameters are taken by value, so that coroutine
+    /// implementations keep them alive.
+    /// </summary>
+    struct IWamClient
+    {
+        virtual ~IWamClient() = default;
+
+        virtual IAsyncOperation<WebAccountProvider> FindAccountProviderAsync(winrt::hstring providerId, winrt::hstring authority) = 0;
+        virtual IAsyncOperation<FindAllAccountsResult> FindAllAccountsAsync(WebAccountProvider provider, winrt::hstring clientId) = 0;
+
+        // account may be nullptr
+        virtual IAsyncOperation<WebTokenRequestResult> GetTokenSilentlyAsync(WebTokenRequest request, WebAccount account) = 0;
+
+        // RequestTokenAsync anchored to a window of a desktop app
+        virtual IAsyncOperation<WebTokenRequestResult> RequestTokenForWindowAsync(HWND hwnd, WebTokenRequest request) = 0;
+
+        // account must be one returned by FindAllAccountsAsync of this client
+        virtual IAsyncAction SignOutAsync(WebAccount account) = 0;
+    };
+
+    class WamClient final : public IWamClient
+    {
+    public:
+        IAsyncOperation<WebAccountProvider> FindAccountProviderAsync(const winrt::hstring providerId, const winrt::hstring authority) override
+        {
+            return WebAuthenticationCoreManager::FindAccountProviderAsync(providerId, authority);
+        }
+
+        IAsyncOperation<FindAllAccountsResult> FindAllAccountsAsync(const WebAccountProvider provider, const winrt::hstring clientId) override
+        {
+            return WebAuthenticationCoreManager::FindAllAccountsAsync(provider, clientId);
+        }
+
+        IAsyncOperation<WebTokenRequestResult> GetTokenSilentlyAsync(const WebTokenRequest request, const WebAccount account) override
+        {
+            return account
+                ? WebAuthenticationCoreManager::GetTokenSilentlyAsync(request, account)
+                : WebAuthenticationCoreManager::GetTokenSilentlyAsync(request);
+        }
+
+        IAsyncOperation<WebTokenRequestResult> RequestTokenForWindowAsync(const HWND hwnd, const WebTokenRequest request) override
+        {
+            // Invoke RequestTokenAsync() via IWebAuthenticationCoreManagerInterop::RequestTokenForWindowAsync()
+            // https://devblogs.microsoft.com/oldnewthing/20210805-00/?p=105520
+            auto interop = winrt::get_activation_factory<WebAuthenticationCoreManager, IWebAuthenticationCoreManagerInterop>();
+            auto requestInspectable = static_cast<::IInspectable*>(winrt::get_abi(request));
+
+            return winrt::capture<IAsyncOperation<WebTokenRequestResult>>(
+                interop,
+                &IWebAuthenticationCoreManagerInterop::RequestTokenForWindowAsync,
+                hwnd,
+                requestInspectable);
+        }
+
+        IAsyncAction SignOutAsync(const WebAccount account) override
+        {
+            return account.SignOutAsync();
+        }
+    };
+
+    /// <summary>
+    /// Behavior of SyntheticWamClient
+    /// </summary>
+    struct SyntheticConfig
+    {
+        // Latency of every call follows a log-normal distribution with this median & 99th percentile. A median of 0 completes at once
+        std::chrono::duration<double, std::milli> Median{ 5 };
+        std::chrono::duration<double, std::milli> P99{ 20 };
+
+        // Share of token requests that return ResponseStatus ProviderError
+        double ErrorRate = 0;
+
+        // Share of calls that throw an hresult_error, as a broken broker connection does (retried under --retries)
+        double ThrowRate = 0;
+
+        // Accounts returned by FindAllAccountsAsync: user01@example.com, user02@example.com, ...
+        int Accounts = 1;
+    };
+
+    inline constexpr int MaxSyntheticAccounts = 1000;
+
+    /// <summary>
+    /// Parse comma separated key=value fields: median & p99 (milliseconds), error & throw (0 to 1), accounts (0 to 1000).
+    /// e.g. "median=5,p99=40,error=0.01". Missing fields keep their defaults. Unless median is 0, p99 must be greater than median.
+    /// </summary>
+    inline std::expected<SyntheticConfig, std::string> ParseSyntheticConfig(std::string_view spec)
+    {
+        auto config = SyntheticConfig{};
+
+        while (not spec.empty())
+        {
+            const auto end = spec.find(',');
+            const auto field = spec.substr(0, end);
+            spec = end == std::string_view::npos ? std::string_view{} : spec.substr(end + 1);
+
+            if (field.empty())
+            {
+                continue;
+            }
+
+            const auto pos = field.find('=');
+            const auto key = field.substr(0, pos);
+            auto value = double{};
+
+            if (pos == std::string_view::npos || std::from_chars(field.data() + pos + 1, field.data() + field.size(), value).ec != std::errc{}
+                || not std::isfinite(value) || value < 0)
+            {
+                return std::unexpected{ std::format("Invalid synthetic field '{}'. Fields must look like key=<non-negative number>", field) };
+            }
+
+            if (Util::EqualsIgnoreCase(key, "median"))
+            {
+                config.Median = std::chrono::duration<double, std::milli>{ value };
+            }
+            else if (Util::EqualsIgnoreCase(key, "p99"))
+            {
+                config.P99 = std::chrono::duration<double, std::milli>{ value };
+            }
+            else if (Util::EqualsIgnoreCase(key, "error") && value <= 1)
+            {
+                config.ErrorRate = value;
+            }
+            else if (Util::EqualsIgnoreCase(key, "throw") && value <= 1)
+            {
+                config.ThrowRate = value;
+            }
+            else if (Util::EqualsIgnoreCase(key, "accounts") && value <= MaxSyntheticAccounts && value == std::floor(value))
+            {
+                config.Accounts = static_cast<int>(value);
+            }
+            else
+            {
+                return std::unexpected{ std::format("Invalid synthetic field '{}'. Keys are median, p99, error (0-1), throw (0-1), and accounts (0-{})", field, MaxSyntheticAccounts) };
+            }
+        }
+
+        // A p99 at the median would make the distribution degenerate (sigma 0)
+        if (config.Median.count() > 0 and config.P99 <= config.Median)
+        {
+            return std::unexpected{ std::format("Invalid synthetic config. p99 ({} ms) must be greater than median ({} ms)", config.P99.count(), config.Median.count()) };
+        }
+
+        return config;
+    }
+
+    namespace detail
+    {
+        /// <summary>
+        /// A WebTokenRequestResult made up by SyntheticWamClient. The class has no public constructor, but it is its
+        /// default interface, so an implementation of IWebTokenRequestResult can stand in for it.
+        /// </summary>
+        struct SyntheticTokenRequestResult : winrt::implements<SyntheticTokenRequestResult, IWebTokenRequestResult>
+        {
+            explicit SyntheticTokenRequestResult(WebTokenResponse response) :
+                _status{ WebTokenRequestStatus::Success },
+                _data{ winrt::single_threaded_vector<WebTokenResponse>({ std::move(response) }).GetView() }
+            {}
+
+            explicit SyntheticTokenRequestResult(WebProviderError error) :
+                _status{ WebTokenRequestStatus::ProviderError },
+                _data{ winrt::single_threaded_vector<WebTokenResponse>().GetView() },
+                _error{ std::move(error) }
+            {}
+
+            Collections::IVectorView<WebTokenResponse> ResponseData() const { return _data; }
+            WebTokenRequestStatus ResponseStatus() const { return _status; }
+            WebProviderError ResponseError() const { return _error; }
+            IAsyncAction InvalidateCacheAsync() const { co_return; }
+
+        private:
+            const WebTokenRequestStatus _status;
+            const Collections::IVectorView<WebTokenResponse> _data;
+            const WebProviderError _error{ nullptr };
+        };
+
+        // Same for FindAllAccountsResult
+        struct SyntheticFindAllAccountsResult : winrt::implements<SyntheticFindAllAccountsResult, IFindAllAccountsResult>
+        {
+            explicit SyntheticFindAllAccountsResult(Collections::IVectorView<WebAccount> accounts) : _accounts{ std::move(accounts) }
+            {}
+
+            Collections::IVectorView<WebAccount> Accounts() const { return _accounts; }
+            FindAllWebAccountsStatus Status() const { return FindAllWebAccountsStatus::Success; }
+            WebProviderError ProviderError() const { return nullptr; }
+
+        private:
+            const Collections::IVectorView<WebAccount> _accounts;
+        };
+
+        inline void AppendBase64Url(std::string& out, std::string_view data)
+        {
+            constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+            auto bits = std::uint32_t{ 0 };
+            auto bitCount = 0;
+
+            for (const auto c : data)
+            {
+                bits = (bits << 8) | static_cast<std::uint8_t>(c);
+                bitCount += 8;
+
+                while (bitCount >= 6)
+                {
+                    bitCount -= 6;
+                    out.push_back(alphabet[(bits >> bitCount) & 0x3F]);
+                }
+            }
+
+            if (bitCount > 0)
+            {
+                out.push_back(alphabet[(bits << (6 - bitCount)) & 0x3F]);
+            }
+        }
+
+        /// <summary>
+        /// An unsigned JWT with iat, nbf & exp, so that the lifetime & cache classification code sees a real-looking token
+        /// </summary>
+        inline winrt::hstring MakeSyntheticToken(std::chrono::system_clock::time_point issuedAt)
+        {
+            const auto iat = std::chrono::duration_cast<std::chrono::seconds>(issuedAt.time_since_epoch()).count();
+            auto token = std::string{};
+
+            AppendBase64Url(token, R"({"alg":"none","typ":"JWT"})");
+            token.push_back('.');
+            AppendBase64Url(token, std::format(R"({{"aud":"synthetic","iat":{0},"nbf":{0},"exp":{1}}})", iat, iat + 3600));
+            token.append(".synthetic");
+
+            return winrt::to_hstring(token);
+        }
+    }
+
+    /// <summary>
+    /// Answers the WAM calls without a broker, after a random latency, with the configured share of errors.
+    /// Every token request returns the same token (as a broker's cache would), so calls cost no more than the objects they return.
+    /// </summary>
+    class SyntheticWamClient final : public IWamClient
+    {
+    public:
+        explicit SyntheticWamClient(const SyntheticConfig& config) :
+            _config{ config },
+            _mu{ config.Median.count() > 0 ? std::log(config.Median.count()) : 0.0 },
+            // The 99th percentile of a log-normal distribution is exp(mu + 2.326 sigma)
+            _sigma{ config.P99 > config.Median and config.Median.count() > 0 ? std::log(config.P99 / config.Median) / 2.326 : 0.0 },
+            _provider{ ProviderId::MICROSOFT, L"Synthetic", Uri{ ProviderId::MICROSOFT } },
+            _token{ detail::MakeSyntheticToken(std::chrono::system_clock::now()) }
+        {
+            auto accounts = winrt::single_threaded_vector<WebAccount>();
+
+            for (int i = 1; i <= config.Accounts; ++i)
+            {
+                accounts.Append(WebAccount{ _provider, winrt::to_hstring(std::format("user{:02}@example.com", i)), WebAccountState::Connected });
+            }
+
+            _accounts = accounts.GetView();
+        }
+
+        IAsyncOperation<WebAccountProvider> FindAccountProviderAsync(const winrt::hstring /*providerId*/, const winrt::hstring /*authority*/) override
+        {
+            co_await DelayAsync();
+            co_return _provider;
+        }
+
+        IAsyncOperation<FindAllAccountsResult> FindAllAccountsAsync(const WebAccountProvider /*provider*/, const winrt::hstring /*clientId*/) override
+        {
+            co_await DelayAsync();
+            co_return winrt::make<detail::SyntheticFindAllAccountsResult>(_accounts).as<FindAllAccountsResult>();
+        }
+
+        IAsyncOperation<WebTokenRequestResult> GetTokenSilentlyAsync(const WebTokenRequest /*request*/, const WebAccount account) override
+        {
+            co_await DelayAsync();
+            co_return MakeResult(account);
+        }
+
+        IAsyncOperation<WebTokenRequestResult> RequestTokenForWindowAsync(const HWND /*hwnd*/, const WebTokenRequest /*request*/) override
+        {
+            co_await DelayAsync();
+            co_return MakeResult(nullptr);
+        }
+
+        IAsyncAction SignOutAsync(const WebAccount /*account*/) override
+        {
+            // The accounts are not known to the broker, so there is nothing to sign out of
+            co_await DelayAsync();
+        }
+
+    private:
+        static std::minstd_rand& Engine()
+        {
+            thread_local auto engine = std::minstd_rand{ std::random_device{}() };
+            return engine;
+        }
+
+        // Wait for a latency drawn from the distribution, then maybe throw
+        IAsyncAction DelayAsync() const
+        {
+            if (_config.Median.count() > 0 and _sigma <= 0)
+            {
+                co_await winrt::resume_after(std::chrono::duration_cast<winrt::Windows::Foundation::TimeSpan>(_config.Median));
+            }
+            else if (_config.Median.count() > 0)
+            {
+                // std::lognormal_distribution requires sigma > 0
+                auto distribution = std::lognormal_distribution<double>{ _mu, _sigma };
+                co_await winrt::resume_after(std::chrono::duration_cast<winrt::Windows::Foundation::TimeSpan>(std::chrono::duration<double, std::milli>{ distribution(Engine()) }));
+            }
+
+            if (_config.ThrowRate > 0 && std::uniform_real_distribution<double>{}(Engine()) < _config.ThrowRate)
+            {
+                throw winrt::hresult_error{ RPC_E_DISCONNECTED, L"Synthetic broker failure" };
+            }
+        }
+
+        WebTokenRequestResult MakeResult(const WebAccount& account) const
+        {
+            if (_config.ErrorRate > 0 && std::uniform_real_distribution<double>{}(Engine()) < _config.ErrorRate)
+            {
+                return winrt::make<detail::SyntheticTokenRequestResult>(WebProviderError{ 0xCAA2000Cu, L"Synthetic provider error" }).as<WebTokenRequestResult>();
+            }
+
+            auto tokenAccount = account;
+
+            if (not tokenAccount && _accounts.Size() > 0)
+            {
+                tokenAccount = _accounts.GetAt(0);
+            }
+
+            auto response = WebTokenResponse{ _token, tokenAccount };
+
+            if (tokenAccount)
+            {
+                response.Properties().Insert(L"UPN", tokenAccount.UserName());
+            }
+
+            return winrt::make<detail::SyntheticTokenRequestResult>(std::move(response)).as<WebTokenRequestResult>();
+        }
+
+        const SyntheticConfig _config;
+        const double _mu;
+        const double _sigma;
+        const WebAccountProvider _provider;
+        const winrt::hstring _token;
+        Collections::IVectorView<WebAccount> _accounts{ nullptr };
+    };
+}